@@ -0,0 +1,215 @@
+#include "./include/util.h"
+#include "./include/arena.h"
+#include "./include/tracer.h"
+
+/*
+    Renders a fixed set of scenes at a fixed resolution with 1, 2, 4 .. N threads
+    and writes the results as JSON so runs from different builds can be diffed.
+
+    Everything that changes the work done is pinned: scenes are built from SCENE_SEED,
+    every sample keys its RNG on its pixel and sample index, and adaptive sampling is off,
+    so every run traces exactly the same rays whatever the thread count.
+*/
+
+#define BENCH_WIDTH             640
+#define BENCH_HEIGHT            360
+#define BENCH_SAMPLES_PER_FRAME 1
+#define BENCH_WARMUP_FRAMES     1
+#define BENCH_MAX_RUNS          32
+
+typedef struct bench_scene_t
+{
+    enum scene_id   id;
+    i32             max_depth;
+}bench_scene_t;
+
+static const bench_scene_t bench_scenes[] = {
+    {SceneSpheres,      20},
+    {SceneRandomField,  20},
+    {SceneGlass,        50},
+    {SceneLights,       20},
+};
+
+typedef struct bench_run_t
+{
+    u32 threads;
+    f64 ms_per_frame;           // mean over the measured frames
+    f64 min_ms;
+    f64 max_ms;
+    render_stats_t stats;       // summed over the measured frames
+}bench_run_t;
+
+static void bench_run(const bench_scene_t *scene, u32 threads, u32 frames, bench_run_t *run)
+{
+    gc.thread_pool = CHECK_PTR(thread_pool_create(threads));
+    gc.max_depth   = scene->max_depth;
+
+    // same starting point every run, the accumulation state feeds the tile seeds
+    init_scene(scene->id);
+    scene_array_build_bvh(gc.scene_objects);
+
+    *run = (bench_run_t){.threads = threads, .min_ms = DBL_MAX};
+
+    f64 total_ms = 0.0;
+
+    for (u32 frame = 0; frame < BENCH_WARMUP_FRAMES + frames; frame++)
+    {
+        u64 start_ns = get_time_ns();
+
+        render_frame_begin();
+        render_frame_end();
+
+        f64 elapsed_ms = (f64)(get_time_ns() - start_ns) * 1e-6;
+
+        arena_reset(gc.frame_arena);
+
+        if (frame < BENCH_WARMUP_FRAMES) {
+            continue;
+        }
+
+        total_ms    += elapsed_ms;
+        run->min_ms  = MIN(run->min_ms, elapsed_ms);
+        run->max_ms  = MAX(run->max_ms, elapsed_ms);
+
+        render_stats_add(&run->stats, &gc.frame_stats);
+    }
+
+    run->ms_per_frame = total_ms / (f64)frames;
+
+    thread_pool_destroy(&gc.thread_pool);
+}
+
+static void bench_usage(const char *exe)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --frames N       measured frames per run   (default 8)\n"
+            "  --threads N      highest thread count      (default all cores)\n"
+            "  --output PATH    write the JSON there      (default stdout)\n",
+            exe);
+}
+
+int main(int argc, char **argv)
+{
+    u32 frames      = 8;
+    u32 max_threads = (u32)get_core_count();
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if      (value && strcmp(argv[i], "--frames")  == 0) frames      = (u32)atoi(value);
+        else if (value && strcmp(argv[i], "--threads") == 0) max_threads = (u32)atoi(value);
+        else if (value && strcmp(argv[i], "--output")  == 0) output      = value;
+        else {
+            bench_usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    if (frames == 0 || max_threads == 0) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror("Failed to open output");
+        return 1;
+    }
+
+    // thread counts double up to the max, which is always measured
+    u32 thread_counts[BENCH_MAX_RUNS];
+    u32 run_count = 0;
+    for (u32 t = 1; t < max_threads && run_count < BENCH_MAX_RUNS - 1; t *= 2) {
+        thread_counts[run_count++] = t;
+    }
+    thread_counts[run_count++] = max_threads;
+
+    init_camera(BENCH_WIDTH, (f32)BENCH_WIDTH / (f32)BENCH_HEIGHT);
+    gc.screen_height = BENCH_HEIGHT;
+    update_camera_view();
+
+    // a fixed number of samples every frame, the budget never runs out
+    gc.samples_per_frame = BENCH_SAMPLES_PER_FRAME;
+    gc.samples_per_pixel = BENCH_SAMPLES_PER_FRAME * (BENCH_WARMUP_FRAMES + frames);
+    gc.adaptive_error    = 0.0f;
+
+    gc.frame_arena = arena_new();
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"width\": %d,\n", BENCH_WIDTH);
+    fprintf(out, "  \"height\": %d,\n", BENCH_HEIGHT);
+    fprintf(out, "  \"samples_per_frame\": %d,\n", BENCH_SAMPLES_PER_FRAME);
+    fprintf(out, "  \"frames\": %u,\n", frames);
+    fprintf(out, "  \"seed\": %d,\n", SCENE_SEED);
+    fprintf(out, "  \"sampler\": \"%s\",\n", sampler_names[gc.sampler]);
+    fprintf(out, "  \"cores\": %d,\n", get_core_count());
+    fprintf(out, "  \"scenes\": [\n");
+
+    for (u32 s = 0; s < NUM_ELEMS(bench_scenes); s++)
+    {
+        const bench_scene_t *scene = &bench_scenes[s];
+        bench_run_t runs[BENCH_MAX_RUNS];
+
+        for (u32 r = 0; r < run_count; r++)
+        {
+            bench_run(scene, thread_counts[r], frames, &runs[r]);
+
+            fprintf(stderr, "%-14s %3u threads %10.3f ms/frame %8.2f Mrays/s\n",
+                    scene_names[scene->id], runs[r].threads, runs[r].ms_per_frame,
+                    (f64)(runs[r].stats.primary_rays + runs[r].stats.secondary_rays) / (runs[r].ms_per_frame * frames * 1e3));
+        }
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"name\": \"%s\",\n", scene_names[scene->id]);
+        fprintf(out, "      \"objects\": %zu,\n", gc.scene_objects->count);
+        fprintf(out, "      \"max_depth\": %d,\n", scene->max_depth);
+        fprintf(out, "      \"runs\": [\n");
+
+        for (u32 r = 0; r < run_count; r++)
+        {
+            bench_run_t *run = &runs[r];
+            render_stats_t *stats = &run->stats;
+            u64 rays     = stats->primary_rays + stats->secondary_rays;
+            f64 seconds  = run->ms_per_frame * frames * 1e-3;
+            f64 speedup  = runs[0].ms_per_frame / run->ms_per_frame;   // runs[0] is single threaded
+
+            fprintf(out, "        {\n");
+            fprintf(out, "          \"threads\": %u,\n", run->threads);
+            fprintf(out, "          \"mrays_per_s\": %.3f,\n", (f64)rays / seconds * 1e-6);
+            fprintf(out, "          \"ms_per_frame\": %.4f,\n", run->ms_per_frame);
+            fprintf(out, "          \"min_ms\": %.4f,\n", run->min_ms);
+            fprintf(out, "          \"max_ms\": %.4f,\n", run->max_ms);
+            fprintf(out, "          \"primary_rays\": %llu,\n", (unsigned long long)stats->primary_rays);
+            fprintf(out, "          \"secondary_rays\": %llu,\n", (unsigned long long)stats->secondary_rays);
+            fprintf(out, "          \"primary_rays_per_s\": %.1f,\n", (f64)stats->primary_rays / seconds);
+            fprintf(out, "          \"secondary_rays_per_s\": %.1f,\n", (f64)stats->secondary_rays / seconds);
+            fprintf(out, "          \"escaped_rays\": %llu,\n", (unsigned long long)stats->escaped);
+            fprintf(out, "          \"sphere_tests\": %llu,\n", (unsigned long long)stats->sphere_tests);
+            fprintf(out, "          \"bvh_nodes_visited\": %llu,\n", (unsigned long long)stats->bvh_nodes);
+            fprintf(out, "          \"avg_path_depth\": %.4f,\n", (f64)stats->bounces / (f64)MAX(stats->primary_rays, 1));
+            fprintf(out, "          \"max_path_depth\": %u,\n", stats->max_path_depth);
+            fprintf(out, "          \"speedup\": %.4f,\n", speedup);
+            fprintf(out, "          \"scaling_efficiency\": %.4f\n", speedup / (f64)run->threads);
+            fprintf(out, "        }%s\n", (r + 1 < run_count) ? "," : "");
+        }
+
+        fprintf(out, "      ]\n");
+        fprintf(out, "    }%s\n", (s + 1 < NUM_ELEMS(bench_scenes)) ? "," : "");
+    }
+
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    scene_array_destroy(&gc.scene_objects);
+    arena_delete(&gc.frame_arena);
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+#include "./include/util.h"
+
+/*
+    Entry point of the headless renderer, same as `Main --headless`
+    but without linking GLFW/GL so it runs on machines without a display.
+*/
+int headless_main(int argc, char **argv);
+
+int main(int argc, char **argv)
+{
+    return headless_main(argc, argv);
+}
@@ -2,164 +2,21 @@
 #include <GLFW/glfw3.h>
 
 #define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "./external/include/stb_image.h"
-#include "./external/include/stb_image_write.h"
 
-#define PROF_IMPLEMENTATION
 #include "./include/util.h"
 #include "./include/font.h"
 #include "./include/prof.h"
 #include "./include/arena.h"
 #include "./include/base_graphics.h"
-
-typedef struct ray_t
-{
-    vec3f_t  orig;
-    vec3f_t  dir;
-}ray_t;
-
-#define RAY_AT(r,t) vec3f_add(r->orig, vec3f_scale(r->dir, t)) 
-
-typedef struct camera_t
-{
-    vec3f_t pos;
-    vec3f_t target;
-    vec3f_t up;
-    
-    vec3f_t u;
-    vec3f_t v;
-    vec3f_t w;
-
-    f32 vfov;
-    f32 speed;
-
-    f32 defocus_angle;
-    f32 focus_dist;
-
-    vec3f_t defocus_disk_u;
-    vec3f_t defocus_disk_v;
-
-}camera_t;
-
-enum material_type
-{
-    Lambertian,     // Perfectly diffuse light ?
-    Metal,     
-    Dielectric,     // Glass like
-    Emissive,       
-};
-
-typedef struct material_t
-{
-    enum material_type mat_type;
-    vec3f_t albedo;                 // whiteness
-    f32 fuzz;                       // Lambertian
-    f32 refraction_index;           // Dielectric
-}material_t;
-
-typedef struct hit_record_t
-{
-    vec3f_t hit_point;      
-    vec3f_t norm;
-    f32 hit_dist;
-    material_t mat;
-    bool front_face;
-}hit_record_t;
-
-enum object_type{
-    Sphere
-};
-
-typedef struct sphere_t 
-{
-    vec3f_t     center;
-    f32         radius;
-    material_t  mat;
-}sphere_t;
-
-typedef struct scene_object_t
-{
-    enum object_type type;
-    void *object;
-}scene_object_t;
-
-typedef struct scene_objects_t
-{
-    scene_object_t *objects;    
-    size_t count;               
-    size_t capacity;            
-} scene_objects_t;
-
-#define FRAME_HISTORY_SIZE  64
-#define BUFFER_SIZE         512
-
-struct context_t
-{
-    void               *window;
-    u32                 screen_width;
-    u32                 screen_height;
-    image_view_t        draw_buffer;
-
-    GLuint              texture;
-    GLuint              read_fbo;
-
-    vec3f_t             pixel00_loc;
-    vec3f_t             pixel_delta_u;
-    vec3f_t             pixel_delta_v;
-
-    camera_t            camera;
-
-    i32                 samples_per_pixel;
-    i32                 max_depth;
-
-    scene_objects_t     *scene_objects;
-
-    u32                 mouseX;
-    u32                 mouseLastX;
-    u32                 mouseY;
-    u32                 mouseLastY;
-    bool                firstMouse;
-    bool                left_button_down;
-    bool                right_button_down;
-
-    u32                 global_scale;
-
-    /* Text */
-    font_t              *font;
-
-    /* FLAGS */
-    bool                running;
-    bool                resize;
-    bool                rescale;
-    bool                render;
-    bool                dock;
-    bool                capture;
-    bool                profile;
-    bool                changed;
-    bool                camera_mode;
-
-    /* TIME */
-    u32                 start_time;
-    u64                 last_render_time;
-    f64                 dt;
-    u64                 render_interval;
-    #ifdef _WIN32
-        LARGE_INTEGER   last_frame_start;
-    #else
-        struct timespec last_frame_start;
-    #endif
-    f64                 frame_history[FRAME_HISTORY_SIZE];
-    i32                 frame_idx;
-    f64                 average_frame_time;
-    f64                 current_fps;
-
-    arena_t             *frame_arena;
-}gc;
+#include "./include/tracer.h"
 
 char frametime[BUFFER_SIZE];
+char render_stats[BUFFER_SIZE];
 
-char prof_buf[64][BUFFER_SIZE];
+char prof_buf[256][BUFFER_SIZE];  // one line per worker on big machines
+i32 trace_frames = 16;             // frames F12 records into trace.json, --trace-frames N
+char (*worker_idle_labels)[32];
 i32 prof_buf_count;
 i32 prof_max_width;
 
@@ -173,100 +30,84 @@ i32 new_x = 0;
 i32 new_y = 0;
 bool test_animation_move = false;
 
-void update_camera_view();
-void render_all(void);
-void increase_fov();
-void decrease_fov();
-void set_fov(f32 new_fov);
-void adjust_fov(f32 delta);
+int headless_main(int argc, char **argv);
+
+/*
+    The tracer runs on its own thread so input and presentation never wait for a frame
+    and a frame never waits for vsync. Finished frames go into a ring of three buffers:
+    the one on screen, the newest finished one and the one being rendered, so the render
+    thread always has a buffer to write to without waiting for the display.
+
+    Everything the workers read (camera, settings, scene) is only changed between
+    render_lock() and render_unlock(), which cancel the frame in flight instead of
+    waiting for it to finish.
+*/
+#define PRESENT_BUFFER_COUNT    3
 
-scene_objects_t* scene_array_create(size_t initial_capacity)
+typedef struct render_thread_t
 {
-    if (initial_capacity == 0) {
-        initial_capacity = 16; // Default initial capacity
-    }
-    
-    scene_objects_t *array = malloc(sizeof(scene_objects_t));
+    thread_handle_t thread;
+    mutex_t         lock;           // held by the render thread for a whole frame
+    cond_var_t      wake;
+    bool            running;
+    bool            dirty;          // settings changed since the last frame
 
-    if (!array) {
-        return NULL;
-    }
-    
-    array->objects = malloc(sizeof(scene_object_t) * initial_capacity);
+    mutex_t         present_lock;   // guards latest and shown
+    image_view_t    buffers[PRESENT_BUFFER_COUNT];
+    i32             latest;         // newest finished frame, -1 until there is one
+    i32             shown;          // on screen, only the main thread reads its pixels
+}render_thread_t;
 
-    if (!array->objects) {
-        free(array);
-        return NULL;
-    }
-    
-    array->count = 0;
-    array->capacity = initial_capacity;
-    
-    return array;
-}
+render_thread_t render_thread;
 
-i32 scene_array_resize(scene_objects_t* array, size_t new_capacity)
+/*
+    Frames reach the texture through pixel buffer objects, glTexSubImage2D returns right
+    away and the copy to the GPU overlaps with tracing the next frame.
+    With ARB_buffer_storage the ring buffers above are the persistently mapped PBOs, so
+    the workers write straight into upload memory. Without it the ring stays in client
+    memory and each new frame is copied into an orphaned PBO first.
+*/
+typedef struct upload_buffers_t
 {
-    if (!array || new_capacity < array->count) {
-        return -1; 
-    }
-    
-    scene_object_t *new_objects = realloc(array->objects, sizeof(scene_object_t) * new_capacity);
-    if (!new_objects) {
-        return -1; // Memory allocation failed
-    }
-    
-    array->objects = new_objects;
-    array->capacity = new_capacity;
-    
-    return 0; // Success
-}
+    GLuint  pbo[PRESENT_BUFFER_COUNT];
+    GLsync  fence[PRESENT_BUFFER_COUNT];    // last upload out of a persistent buffer
+    bool    persistent;
+}upload_buffers_t;
+
+upload_buffers_t upload;
 
-i32 scene_array_add(scene_objects_t* array, scene_object_t object)
+void create_framebuffer(u32 width, u32 height);
+void destroy_framebuffer(void);
+
+void render_lock(void)
 {
-    if (!array) {
-        return -1;
-    }
-    
-    if (array->count >= array->capacity) 
-    {
-        size_t new_capacity = array->capacity * 2;
-        if (scene_array_resize(array, new_capacity) != 0) {
-            return -1; // Resize failed
-        }
-    }
-    
-    array->objects[array->count] = object;
-    array->count++;
-    
-    return 0; 
+    ATOMIC_STORE_U32(&gc.frame_cancel, 1);
+    mutex_lock(&render_thread.lock);
 }
 
-i32 scene_array_remove(scene_objects_t* array, size_t index)
+void render_unlock(void)
 {
-    if (!array || index >= array->count) {
-        return -1; // Invalid parameters
-    }
-    
-    // Shift elements to fill the gap
-    for (size_t i = index; i < array->count - 1; i++) {
-        array->objects[i] = array->objects[i + 1];
-    }
-    
-    array->count--;
-    
-    if (array->count > 0 && array->count < array->capacity / 4) {
-        scene_array_resize(array, array->capacity / 2);
-    }
-    
-    return 0; // Success
+    ATOMIC_STORE_U32(&gc.frame_cancel, 0);
+    render_thread.dirty = true;
+    cond_var_signal(&render_thread.wake);
+    mutex_unlock(&render_thread.lock);
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     (void)window;
-    gc.screen_width  = width;
-    gc.screen_height = height;
+
+    render_lock();
+    if (width > 0 && height > 0 && ((u32)width != gc.screen_width || (u32)height != gc.screen_height))
+    {
+        gc.screen_width  = width;
+        gc.screen_height = height;
+
+        destroy_framebuffer();
+        create_framebuffer(gc.screen_width, gc.screen_height);
+        update_camera_view();
+    }
+    render_unlock();
 
     glViewport(0, 0, gc.screen_width, gc.screen_height);
 }
@@ -354,6 +195,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 
     if (action == GLFW_PRESS || action == GLFW_REPEAT) 
     {
+        render_lock();
+
         switch (key) {
             case GLFW_KEY_BACKSPACE:
                 break;
@@ -361,6 +204,11 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
                 break;
             case GLFW_KEY_TAB:
                 break;
+            case GLFW_KEY_F12:
+                // trace frames that do work, not the resolve of a converged image
+                prof_trace_start("trace.json", trace_frames);
+                reset_accumulation();
+                break;
             case GLFW_KEY_F11:
                 gc.profile ^= 1;
                 break;
@@ -378,6 +226,38 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
                     gc.samples_per_pixel = 50;
                     gc.max_depth = 50;
                 }
+                reset_accumulation();
+                break;
+            case GLFW_KEY_F6:
+                gc.show_sample_count ^= 1;
+                break;
+            case GLFW_KEY_F8:
+                gc.wavefront ^= 1;
+                reset_accumulation();
+                break;
+            case GLFW_KEY_F9:
+                gc.sampler = (gc.sampler + 1) % SamplerTypeCount;
+                reset_accumulation();
+                break;
+            case GLFW_KEY_L:
+                gc.light_sampling ^= 1;
+                reset_accumulation();
+                break;
+            case GLFW_KEY_R:
+                gc.russian_roulette ^= 1;
+                reset_accumulation();
+                break;
+            case GLFW_KEY_MINUS:
+                gc.adaptive_error *= 0.5f;
+                reset_accumulation();
+                break;
+            case GLFW_KEY_EQUAL:
+                gc.adaptive_error = (gc.adaptive_error > 0.0f) ? gc.adaptive_error * 2.0f : 0.01f;
+                reset_accumulation();
+                break;
+            case GLFW_KEY_0:
+                gc.adaptive_error = 0.0f;
+                reset_accumulation();
                 break;
             case GLFW_KEY_W:
                 if(gc.camera_mode)
@@ -459,6 +339,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             default:
                 break;
         }
+
+        render_unlock();
     }
 }
 
@@ -485,21 +367,32 @@ void set_dark_mode(GLFWwindow *window)
 
 void prof_record_results(void)
 {
-    for (int i = 0; i < g_prof_storage.count; i++) 
+    for (int i = 0; i < g_prof_storage.count && prof_buf_count < (i32)NUM_ELEMS(prof_buf); i++) 
     {
         if (g_prof_storage.entries[i].hit_count > 0) 
         {
-            snprintf(prof_buf[i], BUFFER_SIZE, "[PROFILE] %s[%llu]: %.6f ms (total)", 
-                   g_prof_storage.entries[i].label,
-                   (unsigned long long)g_prof_storage.entries[i].hit_count,
-                   g_prof_storage.entries[i].elapsed_ms);
+            // entries without hits are skipped, the lines stay packed for render_prof_entries()
+            char *line = prof_buf[prof_buf_count++];
+
+            if (g_prof_storage.entries[i].is_counter) {
+                snprintf(line, BUFFER_SIZE, "[PROFILE] %*s%s[%llu]: %llu (total)", 
+                       2 * g_prof_storage.entries[i].depth, "",
+                       g_prof_storage.entries[i].label,
+                       (unsigned long long)g_prof_storage.entries[i].hit_count,
+                       (unsigned long long)g_prof_storage.entries[i].value);
+            } else {
+                snprintf(line, BUFFER_SIZE, "[PROFILE] %*s%s[%llu]: %.6f ms (total), %.6f ms (self)", 
+                       2 * g_prof_storage.entries[i].depth, "",
+                       g_prof_storage.entries[i].label,
+                       (unsigned long long)g_prof_storage.entries[i].hit_count,
+                       g_prof_storage.entries[i].elapsed_ms,
+                       g_prof_storage.entries[i].self_ms);
+            }
 
-            i32 text_length = (i32)strlen(prof_buf[i]);
+            i32 text_length = (i32)strlen(line);
             if(text_length > prof_max_width){
                 prof_max_width = text_length;
             }
-            
-            prof_buf_count++;
         }
     }
 }
@@ -525,674 +418,379 @@ void render_prof_entries(void)
     }
 }
 
-/* 
-    We can determine if the ray is inside or outside the sphere.
-    by doing the dot product of the ray direction and the outward normal.
-    If the dot product is positive, the ray is inside the sphere.
-    If it is negative, the ray is outside the sphere. 
-*/
-void set_face_normal(hit_record_t *record, ray_t *ray, vec3f_t *outward_normal)
+void poll_events(void)
 {
-    record->front_face = vec3f_dot(ray->dir, *outward_normal) < 0;
-
-    if(record->front_face)
-    {
-        // ray is outside the sphere
-        record->norm = *outward_normal;
-    }
-    else
-    {
-        // ray is inside the sphere
-        record->norm = vec3f_scale(*outward_normal, -1.0f);
-    }
+    glfwPollEvents();
 }
 
-// Schlick Approximation
-f32 reflectance(f32 cosine, f32 refraction_index)
+// start copying a finished frame into the texture, the call doesn't wait for the copy
+void upload_frame(i32 index)
 {
-    f32 r0 = (1-refraction_index)/(1+refraction_index);
-    r0 = r0*r0;
-    return r0 + (1-r0)*((1-cosine)*(1-cosine)*(1-cosine)*(1-cosine)*(1-cosine));
-}
+    image_view_t *view = &render_thread.buffers[index];
+    GLsizeiptr size = (GLsizeiptr)view->width * view->height * sizeof(color4_t);
 
-bool ray_scatter(ray_t *ray_in, hit_record_t *hit_info, vec3f_t *attenuation, ray_t *ray_scattered)
-{
-    switch (hit_info->mat.mat_type) 
-    {
-        case Lambertian:
-            vec3f_t scatter_dir = vec3f_add(hit_info->norm, vec3f_random_direction());
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.pbo[index]);
 
-            if(vec3f_is_near_zero(scatter_dir))
-            {
-                scatter_dir = hit_info->norm;
-            }
-
-            *ray_scattered = (ray_t){hit_info->hit_point, scatter_dir};
-            *attenuation = hit_info->mat.albedo;
-
-            return true;
-            
-        case Metal:
-            vec3f_t reflected = vec3f_reflect(ray_in->dir, hit_info->norm);
-            reflected = vec3f_add(vec3f_unit(reflected), vec3f_scale(vec3f_random_direction(), hit_info->mat.fuzz));
-            *ray_scattered = (ray_t){hit_info->hit_point, reflected};
-            *attenuation = hit_info->mat.albedo;
-
-            return (vec3f_dot(ray_scattered->dir , hit_info->norm) > 0);
-
-        case Dielectric:
-            *attenuation = (vec3f_t){1.0f,1.0f,1.0f};
-
-            // refraction index ratio based on whether the ray is entering or exiting the material
-            f32 ri = hit_info->front_face ? (1.0f/hit_info->mat.refraction_index) : hit_info->mat.refraction_index;
-
-            vec3f_t unit_direction = vec3f_unit(ray_in->dir);
-
-            // angle between incoming ray and the normal
-            f32 cos_theta = (f32)fmin(vec3f_dot(vec3f_scale(unit_direction,-1.0f), hit_info->norm), 1.0f);
-            f32 sin_theta = (f32)sqrt_f32(1.0f-cos_theta*cos_theta);
-
-            bool cannot_refract = ri * sin_theta > 1.0; // Total Internal Reflection
-            vec3f_t direction;
-
-            // Fresnel Reflectance
-            if(cannot_refract || reflectance(cos_theta,ri) > RAND_FLOAT())
-            {
+    if (!upload.persistent)
+    {
+        // orphan the storage so the driver doesn't wait for the last upload out of it
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst)
+        {
+            memcpy(dst, view->pixels, (size_t)size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
 
-                direction = vec3f_reflect(unit_direction, hit_info->norm);
-            }
-            else
-            {
-                direction = vec3f_refract(unit_direction, hit_info->norm, ri);
-            }
+    glBindTexture(GL_TEXTURE_2D, gc.texture);
 
-            *ray_scattered = (ray_t){hit_info->hit_point, direction};
+    // with a PBO bound the pointer is an offset into it
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 
+                    (int)view->width, (int)view->height,
+                    GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
 
-            return true;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-        case Emissive:
-            break;
-        default:
-            break;
+    if (upload.persistent) {
+        upload.fence[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     }
+}
 
-    return false;
+// the render thread may write into a persistent buffer again once the GPU is done reading it
+void wait_for_upload(i32 index)
+{
+    if (upload.fence[index])
+    {
+        glClientWaitSync(upload.fence[index], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+        glDeleteSync(upload.fence[index]);
+        upload.fence[index] = NULL;
+    }
 }
 
-/*
-    Check if the ray hits a sphere
-*/
-bool hit_sphere(sphere_t *sphere, ray_t *ray, f32 ray_tmin, f32 ray_tmax, hit_record_t *hit_info)
+void render_to_screen(u32 width, u32 height)
 {
-    // vector from ray origin to the sphere
-    vec3f_t oc = vec3f_sub(sphere->center, ray->orig);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gc.read_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // make the default framebuffer active again ?
+    
+    // transfer pixel values from one region of a read framebuffer to another region of a draw framebuffer.
+    glBlitFramebuffer(0, 0, width, height,  // src
+                      0, height, width, 0,  // dst (flipped)    
+                      GL_COLOR_BUFFER_BIT,    
+                      GL_NEAREST);      
+}
 
-    /*
-        A ray: P(t) = origin + t * direction
-        A sphere: (P - center)² = radius²
 
-        Solution of the quadratic equation of the sphere
+bool render_all_parallel(void)
+{
+    bool finished = false;
+    u64 start_ns = get_time_ns();
 
-         -b +- discriminant
-         ------------------  where discriminant = sqrt(b^2 - 4ac)
-                2*a
+    PROFILE("Preparing frame")
+    {
+        render_frame_begin();
+    }
 
-        gives us two solutions (where ray enters and exits the sphere)
+    PROFILE("Waiting for tiles")
+    {
+        finished = render_frame_end();
+    }
 
-        t = (-b ± √(b² - 4ac)) / 2a
-        
-        With (h = -b/2):
-        t = (h ± √(h² - ac)) / a
-
-    */
-    f32 a = vec3f_length_sq(ray->dir);
-    f32 h = vec3f_dot(ray->dir, oc);
-    f32 c = vec3f_length_sq(oc) - sphere->radius * sphere->radius;
-
-    // is there real solutions ?
-    f32 discriminant = h*h - a*c;
-    if(discriminant < 0){
-        // no intersection
+    f64 render_s = (f64)(get_time_ns() - start_ns) * 1e-9;
+
+    // half a frame, nobody sees it
+    if (!finished) {
         return false;
     }
 
-    f32 disc_sqrt = sqrt_f32(discriminant);
-    f32 root = (h - disc_sqrt) / (a); // distance to the CLOSER hit point (entry point)
+    int num_threads = (int)thread_pool_thread_count(gc.thread_pool);
 
-    if(!Surrounds(root, ray_tmin, ray_tmax))
+    for (int i = 0; i < num_threads; i++)
     {
-        root = (h + disc_sqrt) / (a);  // check other root (exit point)
-
-        // if both intersection outside the range just exit
-        if(!Surrounds(root, ray_tmin, ray_tmax))
-        {
-            return false;
-        }
+        thread_pool_stats_t stats;
+        thread_pool_get_stats(gc.thread_pool, i, &stats);
+        prof_record(worker_idle_labels[i], stats.idle_ms);
     }
 
-    hit_info->hit_dist = root;   // Distance along ray to hit point
-    hit_info->hit_point = RAY_AT(ray, hit_info->hit_dist); // 3D pos of the hit point.
-
-    // calculate the surface normal at the hit point
-    // where normal = (hit_point - sphere_center)
-    // outward_normal have unit length so divide the sphere radius.
-    vec3f_t surface_notmal = vec3f_scale(vec3f_sub(hit_info->hit_point, sphere->center), 1.0f/(f32)sphere->radius);
+    render_stats_t *stats = &gc.frame_stats;
+    u64 rays = stats->primary_rays + stats->secondary_rays;
 
-    set_face_normal(hit_info, ray, &surface_notmal);
+    prof_count("Primary rays", stats->primary_rays);
+    prof_count("Secondary rays", stats->secondary_rays);
+    prof_count("Escaped rays", stats->escaped);
+    prof_count("Sphere tests", stats->sphere_tests);
+    prof_count("BVH nodes visited", stats->bvh_nodes);
 
-    hit_info->mat = sphere->mat;
+    // bounces roulette saved show up as terminations, compare with max_depth * primary rays
+    prof_count("Path bounces", stats->bounces);
+    prof_count("Roulette terminations", stats->roulette_kills);
 
-    return true;
-}
+    u32 scale = 2;
+    u32 pos = gc.screen_width-40*gc.font->font_char_width*scale;
 
-bool hit(scene_objects_t *arr, ray_t *ray, f32 ray_tmin, f32 ray_tmax, hit_record_t *hit_info)
-{
-    hit_record_t temp_rec;
-    bool hit_anything = false;
-    f32 closest = ray_tmax;
+    rendered_text_t text = {
+        .font = gc.font,
+        .pos = {.x=pos, .y=0},
+        .color = {.r = 255, .g = 255, .b = 255, .a=255},
+        .scale = scale,
+        .string = frametime
+    };
+    
+    snprintf(frametime, BUFFER_SIZE, "%.2f ms, %d cores, %.1f/%d spp, %s", gc.average_frame_time*1000, num_threads,
+             (f64)gc.accum_spent / (f64)(gc.draw_buffer.width * gc.draw_buffer.height), gc.samples_per_pixel,
+             sampler_names[gc.sampler]);
+    render_n_string_abs(&gc.draw_buffer, &text);
 
-    for(size_t i = 0; i < arr->count; i++)
+    // what the last frame that traced anything did, the converged image keeps showing it
+    if (rays > 0)
     {
-        switch (arr->objects[i].type) 
-        {
-            case Sphere:
-                if(hit_sphere((sphere_t *)arr->objects[i].object, ray, ray_tmin , closest, &temp_rec))
-                {
-                    hit_anything = true;
-                    closest = temp_rec.hit_dist;
-                    *hit_info = temp_rec;
-                }
-            break;
-
-            default :
-            break;
-        }
+        snprintf(render_stats, BUFFER_SIZE, "%.1f Mrays/s, depth %.2f/%u, %.0f%% escaped",
+                 (f64)rays / render_s * 1e-6, (f64)stats->bounces / (f64)MAX(stats->primary_rays, 1),
+                 stats->max_path_depth, 100.0 * (f64)stats->escaped / (f64)MAX(stats->primary_rays, 1));
     }
 
-    return hit_anything;
-}
-
-vec3f_t random_on_hemisphere(vec3f_t *normal)
-{
-    vec3f_t on_unit_sphere = vec3f_random_direction();
-    if(vec3f_dot(on_unit_sphere, *normal) > 0.0){
-        return on_unit_sphere;
-    }else{
-        return vec3f_scale(on_unit_sphere, -1.0f);
-    }
-}
-
-vec3f_t ray_color(ray_t ray, int depth)
-{
-    vec3f_t color = {1.0f, 1.0f, 1.0f};
-    ray_t current_ray = ray;
+    text.pos.y  = gc.font->font_char_height*scale;
+    text.string = render_stats;
+    render_n_string_abs(&gc.draw_buffer, &text);
 
-    for(int i = 0; i < depth; i++)
+    if(gc.profile)
     {
-        hit_record_t rec;
-    
-        if(hit(gc.scene_objects, &current_ray, 0.001f, max_f32, &rec))
-        {
-            ray_t scattered;
-            vec3f_t attenuation;
-            if(ray_scatter(&current_ray, &rec, &attenuation, &scattered))
-            {
-                color = vec3f_mul(color, attenuation);
-            }
-            current_ray = scattered;
-        }
-        else
-        {
-            vec3f_t unit_dir = vec3f_unit(current_ray.dir);
-        
-            // gradient among the y-axis
-            f32 blend_factor = 0.5f * (unit_dir.y + 1.0f);
-        
-            vec3f_t col_norm = vec3f_lerp(
-                (vec3f_t){1.0,1.0,1.0}, // white 
-                (vec3f_t){0.5,0.7,1.0}, // blue
-                blend_factor
-            );
+        render_prof_entries();
+    }
 
-            return vec3f_mul(color, col_norm);
-        }
+    prof_buf_count = 0;
     
+    if(gc.capture)
+    {
+        export_image(&gc.draw_buffer, "capture.tga");
+        gc.capture = false;
     }
-    return (vec3f_t){0.0f, 0.0f, 0.0f};
-}
 
-vec3f_t sample_square()
-{
-    // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-    return (vec3f_t){RAND_FLOAT() - 0.5f, RAND_FLOAT() - 0.5f, 0.0f};
+    return true;
 }
 
-vec3f_t defocus_disk_sample()
-{
-    vec3f_t p = vec3f_random_direction_2d();
-    return vec3f_add(gc.camera.pos, vec3f_add(vec3f_scale(gc.camera.defocus_disk_u, p.x), vec3f_scale(gc.camera.defocus_disk_v, p.y)));
-}
 
-ray_t get_ray(int x, int y)
+void present_frame(image_view_t* view) 
 {
-    vec3f_t offset = sample_square();
-
-    // current pixel (x,y) converted to normalized coordinated wrt to vp
-/*
-    vec3f_t pixel_center = {
-        .x = gc.pixel00_loc.x + (x * gc.pixel_delta_u.x) + (y * gc.pixel_delta_v.x),
-        .y = gc.pixel00_loc.y + (x * gc.pixel_delta_u.y) + (y * gc.pixel_delta_v.y),
-        .z = gc.pixel00_loc.z + (x * gc.pixel_delta_u.z) + (y * gc.pixel_delta_v.z)
-    };
-*/
-
-    // randomly sampled point around the pixel location i, j.
-    vec3f_t pixel_sample = {
-        .x = gc.pixel00_loc.x + ((x+offset.x) * gc.pixel_delta_u.x) + ((y+offset.y) * gc.pixel_delta_v.x),
-        .y = gc.pixel00_loc.y + ((x+offset.x) * gc.pixel_delta_u.y) + ((y+offset.y) * gc.pixel_delta_v.y),
-        .z = gc.pixel00_loc.z + ((x+offset.x) * gc.pixel_delta_u.z) + ((y+offset.y) * gc.pixel_delta_v.z)
-    };
-
-    vec3f_t ray_origin = (gc.camera.defocus_angle <= 0 ) ? gc.camera.pos : defocus_disk_sample();
-    // The vector from the camera center to the pixel center.
-    vec3f_t ray_dir = vec3f_sub(pixel_sample, ray_origin);
-
-    ray_t ray = {ray_origin, ray_dir};
-
-    return ray;
+    render_to_screen(view->width, view->height);
+    glfwSwapBuffers((GLFWwindow*)gc.window);
 }
 
-void increase_fov() 
+// a buffer that is neither on screen nor the next one to go there
+i32 acquire_render_buffer(void)
 {
-    gc.camera.vfov += 5.0f;
-    if (gc.camera.vfov > 120.0f) {
-        gc.camera.vfov = 120.0f; 
-    }
-    update_camera_view();
-}
+    i32 index = 0;
 
-void decrease_fov() 
-{
-    gc.camera.vfov -= 5.0f;
-    if (gc.camera.vfov < 10.0f) {
-        gc.camera.vfov = 10.0f; 
+    mutex_lock(&render_thread.present_lock);
+    while (index == render_thread.latest || index == render_thread.shown) {
+        index++;
     }
-    update_camera_view();
-}
+    mutex_unlock(&render_thread.present_lock);
 
-void set_fov(f32 new_fov)
-{
-    gc.camera.vfov = new_fov;
-    if (gc.camera.vfov < 10.0f) gc.camera.vfov = 10.0f;
-    if (gc.camera.vfov > 120.0f) gc.camera.vfov = 120.0f;
-    update_camera_view();
-}
+    // resizing recreates the buffers under render_lock(), they always match the screen
+    assert(render_thread.buffers[index].width  == gc.screen_width &&
+           render_thread.buffers[index].height == gc.screen_height);
 
-void adjust_fov(f32 delta)
-{
-    gc.camera.vfov += delta;
-    if (gc.camera.vfov < 10.0f) gc.camera.vfov = 10.0f;
-    if (gc.camera.vfov > 120.0f) gc.camera.vfov = 120.0f;
-    update_camera_view();
+    return index;
 }
 
-void update_camera_view() 
+void update_frame_time(f64 frame_time)
 {
-    /* 
-        The viewport is a virtual rectangle in 3D space that represents our "screen"
-        All rays will be cast from camera through points on this viewport
-
-        The viewport height of 2.0 means the virtual screen is 2 world units tall
-        Viewport goes from -1 to +1 in both X and Y directions
-        camera_t at origin (0,0,0) looks at a 2×2 square centered at (0,0,-1)
-
-                                            (0,1)
-                                 ┌────────────┬───────────┐                         
-                                 │            │           │                         
-                                 │            │           │                         
-                                 │            │(0,0)      │                         
-                          (-1,0) |────────────┼───────────| (1,0)                       
-                                 │            │           │                         
-                                 │            │           │                         
-                                 │            │           │                         
-                                 └────────────┴───────────┘                         
-                                            (0,-1)
-                                     
-    */
-
-    // distance from camera to the viewport
-    // f32 focal_length = vec3f_length(vec3f_sub(gc.camera.pos, gc.camera.target));
-
-    f32 theta = radians_from_degrees_f32(gc.camera.vfov);
-    f32 h = tan_f32(theta/2.0f);
-
-    f32 vp_height = 2.0f * h * gc.camera.focus_dist;
-    f32 vp_width = vp_height * ((f32)gc.screen_width/(f32)gc.screen_height);
-
-    gc.camera.w = vec3f_unit(vec3f_sub(gc.camera.pos, gc.camera.target));
-    gc.camera.u = vec3f_unit(vec3f_cross(gc.camera.up, gc.camera.w));
-    gc.camera.v = vec3f_cross(gc.camera.w, gc.camera.u);
-
-    // define viewport orientation in world space
-    vec3f_t vp_u = vec3f_scale(gc.camera.u, vp_width);
-    vec3f_t vp_v = vec3f_scale(gc.camera.v, -vp_height);
-
-    // how much to move in world space when moving one pixel
-    // mapping between screen pixels and viewport coordinates
-    gc.pixel_delta_u = vec3f_scale(vp_u, 1.0f/(f32)gc.screen_width);
-    gc.pixel_delta_v = vec3f_scale(vp_v, 1.0f/(f32)gc.screen_height);
-
-    // positioned relative to the camera center
-    // shifted left by half the width 
-    // and up by half the height
-    // and back by focal length
-    vec3f_t viewport_center = vec3f_sub(gc.camera.pos, vec3f_scale(gc.camera.w, gc.camera.focus_dist));
-    vec3f_t vp_upper_left = vec3f_sub(viewport_center, 
-                                      vec3f_add(vec3f_scale(vp_u, 0.5f), 
-                                               vec3f_scale(vp_v, 0.5f)));
-
-
-    // calculate the center of the first pixel normalized to the viewport
-    gc.pixel00_loc = vec3f_add(vp_upper_left, 
-                      vec3f_add(vec3f_scale(gc.pixel_delta_u, 0.5f), 
-                               vec3f_scale(gc.pixel_delta_v, 0.5f)));
-    
-    f32 defocus_radius = gc.camera.focus_dist * tan_f32(radians_from_degrees_f32(gc.camera.defocus_angle / 2));
-    gc.camera.defocus_disk_u = vec3f_scale(gc.camera.u, defocus_radius);
-    gc.camera.defocus_disk_v = vec3f_scale(gc.camera.v, defocus_radius);
+    gc.frame_history[gc.frame_idx] = frame_time;
+    gc.frame_idx = (gc.frame_idx + 1) % FRAME_HISTORY_SIZE;
 
+    f64 total_time = 0.0;
+    for (int i = 0; i < FRAME_HISTORY_SIZE; i++) {
+        total_time += gc.frame_history[i];
+    }
+    gc.average_frame_time = total_time / FRAME_HISTORY_SIZE;
+    gc.current_fps = (gc.average_frame_time > 0.0) ? (1.0 / gc.average_frame_time) : 0.0;
 }
 
-void init_camera(int window_width, f32 aspect_ratio)
+thread_func_ret_t render_thread_main(thread_func_param_t param)
 {
-    u32 window_height = (u32)(window_width / aspect_ratio);
-
-    assert(window_height > 1);
-
-    gc.screen_width  = window_width;
-    gc.screen_height = window_height;
+    (void)param;
 
-    gc.camera.pos = (vec3f_t){13.0f, 2.0f, 3.0f};
-    gc.camera.target = (vec3f_t){0.0f, 0.0f, 0.0f};
-    gc.camera.up = (vec3f_t){0.0f, 1.0f, 0.0f};
-    gc.camera.vfov  = 60.0f;
-    gc.camera.speed = 2.0f;
+    mutex_lock(&render_thread.lock);
 
-    gc.camera.defocus_angle = 0.6f;
-    gc.camera.focus_dist = 10.0f;
-
-    update_camera_view();
+    while (render_thread.running)
+    {
+        /*
+            Step aside while the main thread wants the settings, and sleep once
+            the image is done refining until something changes.
+        */
+        if (ATOMIC_LOAD_U32(&gc.frame_cancel) || (!render_thread.dirty && gc.frame_samples == 0 && !prof_trace_active()))
+        {
+            cond_var_wait(&render_thread.wake, &render_thread.lock);
+            continue;
+        }
+        render_thread.dirty = false;
 
-    gc.samples_per_pixel = 10;
-    gc.max_depth = 20;
-}
+        i32 target = acquire_render_buffer();
+        gc.frame_target = render_thread.buffers[target].pixels;
 
-void poll_events(void)
-{
-    glfwPollEvents();
-}
+        u64 start_ns = get_time_ns();
+        bool finished = false;
 
-void render_to_screen(void *pixels, u32 width, u32 height)
-{
-    glBindTexture(GL_TEXTURE_2D, gc.texture);
+        PROFILE("Rendering all multithreaded")
+        {
+            finished = render_all_parallel();
+        }
 
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 
-                    (int)width, (int)height,
-                    GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-    
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, gc.read_fbo);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // make the default framebuffer active again ?
-    
-    // transfer pixel values from one region of a read framebuffer to another region of a draw framebuffer.
-    glBlitFramebuffer(0, 0, width, height,  // src
-                      0, height, width, 0,  // dst (flipped)    
-                      GL_COLOR_BUFFER_BIT,    
-                      GL_NEAREST);      
-}
+        arena_reset(gc.frame_arena);
 
-typedef struct {
-    u32 start_x, end_x;
-    u32 start_y, end_y;
-    u32 width, height;
-} tile_data_t;
+        // the zones of every thread, cancelled frames included so they don't leak into the next one
+        prof_merge();
 
-thread_func_ret_t render_tile(thread_func_param_t data) 
-{
-    tile_data_t *tile = (tile_data_t *)data;
+        if (finished)
+        {
+            update_frame_time((f64)(get_time_ns() - start_ns) * 1e-9);
 
-    fast_srand(tile->start_x * 1000 + tile->start_y + 1);
+            mutex_lock(&render_thread.present_lock);
+            render_thread.latest = target;
+            mutex_unlock(&render_thread.present_lock);
 
-    vec3f_t color;
-    
-    for (u32 y = tile->start_y; y < tile->end_y; ++y) 
-    {
-        for (u32 x = tile->start_x; x < tile->end_x; ++x) 
-        {
-            color = (vec3f_t){0, 0, 0};
-            for (int sample = 0; sample < gc.samples_per_pixel; sample++) 
-            {
-                ray_t ray = get_ray(x, y);
-                color = vec3f_add(color, ray_color(ray, gc.max_depth));
-            }
-            color = vec3f_scale(color, (f32)1.0f/(f32)gc.samples_per_pixel);
-            color = linear_to_gamma(color);
-            set_pixel(&gc.draw_buffer, x, y, to_color4(color));
+            prof_sort_results();
+            prof_record_results();
+            prof_print_results();
+            prof_trace_frame();
         }
+        prof_reset();
     }
 
-    #ifdef _WIN32
-        return 0;
-    #else
-        return NULL;
-    #endif
+    mutex_unlock(&render_thread.lock);
+
+    return 0;
 }
 
-void render_all_parallel(void)
+void render_thread_start(void)
 {
-    gc.draw_buffer.height = gc.screen_height;
-    gc.draw_buffer.width  = gc.screen_width;
+    mutex_init(&render_thread.lock);
+    mutex_init(&render_thread.present_lock);
+    cond_var_init(&render_thread.wake);
 
-    u32 height  = gc.draw_buffer.height;
-    u32 width   = gc.draw_buffer.width;
+    render_thread.running = true;
+    render_thread.dirty   = true;
 
-    gc.draw_buffer.pixels = ARENA_ALLOC(gc.frame_arena, height * width * sizeof(color4_t));
+    render_thread.thread = create_thread(render_thread_main, NULL);
+}
 
-    clear_screen(&gc.draw_buffer, HEX_TO_COLOR4(0x282a36));
+void render_thread_stop(void)
+{
+    render_lock();
+    render_thread.running = false;
+    render_unlock();
 
-    int num_threads = get_core_count()*2;
-    const u32 tile_size = 64;
+    join_thread(render_thread.thread);
 
-    u32 tiles_x = CEIL_DIV(width, tile_size);
-    u32 tiles_y = CEIL_DIV(height, tile_size);
-    u32 total_tiles = tiles_x * tiles_y;
+    cond_var_destroy(&render_thread.wake);
+    mutex_destroy(&render_thread.present_lock);
+    mutex_destroy(&render_thread.lock);
+}
 
-    tile_data_t* tiles = ARENA_ALLOC(gc.frame_arena, total_tiles * sizeof(tile_data_t));
-    thread_handle_t* threads = ARENA_ALLOC(gc.frame_arena, num_threads * sizeof(thread_handle_t));
+// show the newest finished frame, uploading it only if it wasn't on screen already
+void present_latest_frame(void)
+{
+    mutex_lock(&render_thread.present_lock);
+    bool fresh = render_thread.latest >= 0 && render_thread.latest != render_thread.shown;
+    mutex_unlock(&render_thread.present_lock);
 
-    i32 tile_idx = 0;
-    
-    for (u32 ty = 0; ty < tiles_y; ty++) 
+    if (fresh)
     {
-        u32 start_y = ty * tile_size;
-        u32 end_y = (start_y + tile_size > height) ? height : start_y + tile_size;
-        
-        for (u32 tx = 0; tx < tiles_x; tx++) 
-        {
-            u32 start_x = tx * tile_size;
-            u32 end_x = (start_x + tile_size > width) ? width : start_x + tile_size;
-            
-            tiles[tile_idx] = (tile_data_t){
-                .start_x = start_x, .end_x = end_x,
-                .start_y = start_y, .end_y = end_y,
-                .width = width, .height = height
-            };
-            
-            int thread_slot = tile_idx % num_threads;
-            
-            if (tile_idx >= num_threads) {
-                PROFILE("Waiting for a slot"){
-                    join_thread(threads[thread_slot]);
-                }
-            }
-            
-            PROFILE("Actually creating a thread, does it matter ?")
-            {
-                threads[thread_slot] = create_thread(render_tile, &tiles[tile_idx]);
-            }
-            
-            tile_idx++;
+        // the buffer on screen goes back to the render thread, its upload has to be over
+        if (render_thread.shown >= 0) {
+            wait_for_upload(render_thread.shown);
         }
-    }
 
-    int remaining_threads = (total_tiles < num_threads) ? total_tiles : num_threads;
+        mutex_lock(&render_thread.present_lock);
+        render_thread.shown = render_thread.latest;
+        mutex_unlock(&render_thread.present_lock);
 
-    PROFILE("Waiting to join")
-    {
-        for (int i = 0; i < remaining_threads; i++) {
-            join_thread(threads[i]);
-        }
+        upload_frame(render_thread.shown);
     }
 
-    u32 scale = 2;
-    u32 pos = gc.screen_width-20*gc.font->font_char_width*scale;
-
-    rendered_text_t text = {
-        .font = gc.font,
-        .pos = {.x=pos, .y=0},
-        .color = {.r = 255, .g = 255, .b = 255, .a=255},
-        .scale = scale,
-        .string = frametime
-    };
-    
-    snprintf(frametime, BUFFER_SIZE, "%.2f ms, %d cores", gc.average_frame_time*1000,num_threads);
-    render_n_string_abs(&gc.draw_buffer, &text);
-
-    if(gc.profile)
-    {
-        render_prof_entries();
+    if (render_thread.shown < 0) {
+        glfwSwapBuffers((GLFWwindow*)gc.window);
+        return;
     }
 
-    prof_buf_count = 0;
-    
-    if(gc.capture)
-    {
-        export_image(&gc.draw_buffer, "capture.tga");
-        gc.capture = false;
-    }
+    present_frame(&render_thread.buffers[render_thread.shown]);
 }
 
-void render_all(void)
+// texture the size of the framebuffer and the ring of upload buffers feeding it
+void create_framebuffer(u32 width, u32 height)
 {
-    gc.draw_buffer.height = gc.screen_height;
-    gc.draw_buffer.width  = gc.screen_width;
+    glBindTexture(GL_TEXTURE_2D, gc.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 
+                 (int)width, (int)height,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
-    u32 height       = gc.draw_buffer.height;
-    u32 width        = gc.draw_buffer.width;
+    GLsizeiptr size = (GLsizeiptr)width * height * sizeof(color4_t);
 
-    gc.draw_buffer.pixels = ARENA_ALLOC(gc.frame_arena, height * width * sizeof(color4_t));
-    
-    clear_screen(&gc.draw_buffer, HEX_TO_COLOR4(0x282a36));
-    
-    #if 1   
-        vec3f_t color;
+    // read back when the overlay blends over the image, keep the storage on the CPU side
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
-        for (u32 y = 0; y < height; ++y)
-        {
-            for(u32 x = 0; x < width; ++x)
-            {
-                color = (vec3f_t){0, 0, 0};
-                for(int sample = 0; sample < gc.samples_per_pixel; sample++)
-                {
-                    ray_t ray = get_ray(x, y);
-                    color = vec3f_add(color, ray_color(ray, gc.max_depth));
-                }
-                color = vec3f_scale(color, (f32)1.0f/(f32)gc.samples_per_pixel);
-                color = linear_to_gamma(color);
-                set_pixel(&gc.draw_buffer, x, y, to_color4(color));
-            }
-        }
-    #endif
-    
-    #if 0
-    PROFILE("Rendering : Scissors test")
+    glGenBuffers(PRESENT_BUFFER_COUNT, upload.pbo);
+
+    for (u32 i = 0; i < PRESENT_BUFFER_COUNT; i++)
     {
-        draw_rect_outline_wh(&gc.draw_buffer, 50, 50, 200, 300, COLOR_MAGENTA);
+        image_view_t *buffer = &render_thread.buffers[i];
 
-        push_scissor(50, 50, 200, 300);
-            draw_rect_scissored(&gc.draw_buffer,60, 60, 180, 500, COLOR_RED);   
-            draw_rect_scissored(&gc.draw_buffer,80, 200, 60, 40, COLOR_GREEN);
-            draw_rect_scissored(&gc.draw_buffer, gc.mouseX, gc.mouseY, 50, 30, COLOR_BLUE);
-        pop_scissor();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.pbo[i]);
 
-        if(test_animation_move)
+        if (upload.persistent)
         {
-            animation_start((u64)&test_animation.x, 
-                                test_animation.x, test_animation.y,
-                                (f32)new_x, (f32)new_y, 1.0f,
-                                EASE_IN_OUT_QUAD);
-            animation_start((u64)&test_animation.y, 
-                                255.0f, 255.0f,
-                                (f32)0.0f, (f32)155.0f, 1.0f,
-                                EASE_IN_OUT_QUAD);
-            test_animation_move = false;
-            animation_update(gc.dt);
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags | GL_CLIENT_STORAGE_BIT);
+            buffer->pixels = CHECK_PTR(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
         }
-        static f32 col_r = 0.0f;
-        static f32 col_g = 0.0f;
-        animation_get((u64)&test_animation.x, &test_animation.x, &test_animation.y);
-        animation_get((u64)&test_animation.y, &col_r, &col_g);
-        draw_line(&gc.draw_buffer, test_animation.x, test_animation.y, new_x, new_y, HEX_TO_COLOR4(0x50fa7b));
-        draw_rect_scissored(&gc.draw_buffer, (i32)test_animation.x, (i32)test_animation.y,
-                            (u32)test_animation.w, (u32)test_animation.h, (color4_t){(u8)col_r, (u8)col_g, 0, 255}); 
-        
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            buffer->pixels = CHECK_PTR(malloc((size_t)size));
+        }
+
+        buffer->width  = width;
+        buffer->height = height;
+        upload.fence[i] = NULL;
     }
-    #endif
 
-    #if 1
-        u32 scale = 2;
-        u32 pos = gc.screen_width-20*gc.font->font_char_width*scale;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-        rendered_text_t text = {
-            .font = gc.font,
-            .pos = {.x=pos, .y=0},
-            .color = {.r = 255, .g = 255, .b = 255, .a=255},
-            .scale = scale,
-            .string = frametime
-        };
-        
-        snprintf(frametime, BUFFER_SIZE, "%.2f ms", gc.average_frame_time*1000);
-        render_n_string_abs(&gc.draw_buffer, &text);
-    #endif
+    // whatever was in the ring was the old size
+    render_thread.latest = -1;
+    render_thread.shown  = -1;
+}
 
-    if(gc.profile)
+void destroy_framebuffer(void)
+{
+    for (u32 i = 0; i < PRESENT_BUFFER_COUNT; i++)
     {
-        render_prof_entries();
-    }
+        wait_for_upload((i32)i);
 
-    prof_buf_count = 0;
-    
-    if(gc.capture)
-    {
-        export_image(&gc.draw_buffer, "capture.tga");
-        gc.capture = false;
+        if (upload.persistent)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.pbo[i]);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else
+        {
+            free(render_thread.buffers[i].pixels);
+        }
+        render_thread.buffers[i] = (image_view_t){0};
     }
-}
 
-void present_frame(image_view_t* view) 
-{
-    render_to_screen(view->pixels, view->width, view->height);
-    glfwSwapBuffers((GLFWwindow*)gc.window);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(PRESENT_BUFFER_COUNT, upload.pbo);
 }
 
 void init_framebuffer(void)
 {
     glGenTextures(1, &gc.texture);
-    glBindTexture(GL_TEXTURE_2D, gc.texture);
 
-    // Generate a full screen texture
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 
-                 (int)1920, (int)1080,
-                 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    upload.persistent = GLEW_ARB_buffer_storage;
+    printf("Frame upload: %s\n", upload.persistent ? "persistent mapped PBOs" : "PBOs");
+
+    create_framebuffer(gc.screen_width, gc.screen_height);
 
     glGenFramebuffers(1, &gc.read_fbo);
 
@@ -1203,119 +801,6 @@ void init_framebuffer(void)
                            GL_TEXTURE_2D, gc.texture, 0);
 }
 
-sphere_t ground_sphere;
-sphere_t large_sphere_1;     // glass sphere at center
-sphere_t large_sphere_2;     // brown lambertian sphere
-sphere_t large_sphere_3;     // metal sphere
-sphere_t small_spheres[484]; // 22x22 grid, but some will be skipped
-
-void init_scene(void)
-{
-    gc.scene_objects = scene_array_create(0);
-    
-    ground_sphere = (sphere_t){
-        .mat = {
-            .mat_type = Lambertian,
-            .albedo = {0.5f, 0.5f, 0.5f}
-        },
-        .center = (vec3f_t){0.0f, -1000.0f, 0.0f},
-        .radius = 1000.0f
-    };
-    scene_array_add(gc.scene_objects, (scene_object_t){.type=Sphere, .object=&ground_sphere});
-    
-    #if 0
-        // Generate small random spheres
-        int sphere_count = 0;
-        for (int a = -11; a < 11; a++) {
-            for (int b = -11; b < 11; b++) {
-                f32 choose_mat = RAND_FLOAT();
-                vec3f_t center = (vec3f_t){
-                    a + 0.9f * RAND_FLOAT(), 
-                    0.2f, 
-                    b + 0.9f * RAND_FLOAT()
-                };
-                
-                // Check distance from point (4, 0.2, 0)
-                vec3f_t reference_point = (vec3f_t){4.0f, 0.2f, 0.0f};
-                vec3f_t diff = vec3f_sub(center, reference_point);
-                if (vec3f_length(diff) > 0.9f) {
-                    if (choose_mat < 0.8f) {
-                        // Diffuse material
-                        vec3f_t albedo = vec3f_mul(vec3f_random(), vec3f_random());
-                        small_spheres[sphere_count] = (sphere_t){
-                            .mat = {
-                                .mat_type = Lambertian,
-                                .albedo = albedo
-                            },
-                            .center = center,
-                            .radius = 0.2f
-                        };
-                    } else if (choose_mat < 0.95f) {
-                        // Metal material
-                        vec3f_t albedo = vec3f_random_range(0.5f, 1.0f);
-                        f32 fuzz = RAND_FLOAT_RANGE(0.0f, 0.5f);
-                        small_spheres[sphere_count] = (sphere_t){
-                            .mat = {
-                                .mat_type = Metal,
-                                .albedo = albedo,
-                                .fuzz = fuzz
-                            },
-                            .center = center,
-                            .radius = 0.2f
-                        };
-                    } else {
-                        // Glass material
-                        small_spheres[sphere_count] = (sphere_t){
-                            .mat = {
-                                .mat_type = Dielectric,
-                                .refraction_index = 1.5f
-                            },
-                            .center = center,
-                            .radius = 0.2f
-                        };
-                    }
-                    
-                    scene_array_add(gc.scene_objects, (scene_object_t){
-                        .type = Sphere, 
-                        .object = &small_spheres[sphere_count]
-                    });
-                    sphere_count++;
-                }
-            }
-        }
-    #endif
-
-    large_sphere_1 = (sphere_t){
-        .mat = {
-            .mat_type = Dielectric,
-            .refraction_index = 1.5f
-        },
-        .center = (vec3f_t){0.0f, 1.0f, 0.0f},
-        .radius = 1.0f
-    };
-    scene_array_add(gc.scene_objects, (scene_object_t){.type=Sphere, .object=&large_sphere_1});
-    
-    large_sphere_2 = (sphere_t){
-        .mat = {
-            .mat_type = Lambertian,
-            .albedo = {0.4f, 0.2f, 0.1f}
-        },
-        .center = (vec3f_t){-4.0f, 1.0f, 0.0f},
-        .radius = 1.0f
-    };
-    scene_array_add(gc.scene_objects, (scene_object_t){.type=Sphere, .object=&large_sphere_2});
-    
-    large_sphere_3 = (sphere_t){
-        .mat = {
-            .mat_type = Metal,
-            .albedo = {0.7f, 0.6f, 0.5f},
-            .fuzz = 0.0f
-        },
-        .center = (vec3f_t){4.0f, 1.0f, 0.0f},
-        .radius = 1.0f
-    };
-    scene_array_add(gc.scene_objects, (scene_object_t){.type=Sphere, .object=&large_sphere_3});
-}
 void *create_window(u32 width, u32 height, char *title)
 {
     if (!glfwInit()) {
@@ -1367,7 +852,7 @@ bool init_all(void)
     u32 window_width = 1100;
 
     init_camera(window_width, aspect_ratio);
-    init_scene();
+    init_scene(SceneSpheres);
 
     gc.window = create_window(gc.screen_width, gc.screen_height, "Ray");
 
@@ -1376,6 +861,14 @@ bool init_all(void)
     (void)ARENA_ALLOC(gc.frame_arena, 1024*1024*10);
     arena_reset(gc.frame_arena);
 
+    // workers are spawned once and sleep between frames
+    gc.thread_pool = CHECK_PTR(thread_pool_create((u32)get_core_count()));
+
+    worker_idle_labels = CHECK_PTR(malloc(thread_pool_thread_count(gc.thread_pool) * sizeof(*worker_idle_labels)));
+    for (u32 i = 0; i < thread_pool_thread_count(gc.thread_pool); i++) {
+        snprintf(worker_idle_labels[i], sizeof(*worker_idle_labels), "Worker %u idle", i);
+    }
+
     init_framebuffer();
 
     gc.font = init_font((u32*)font_pixels);
@@ -1409,47 +902,39 @@ bool init_all(void)
     return true;
 }
 
-int main(void)
+int main(int argc, char **argv)
 {   
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            return headless_main(argc, argv);
+        }
+        if (strcmp(argv[i], "--trace-frames") == 0 && i + 1 < argc) {
+            trace_frames = atoi(argv[++i]);
+            trace_frames = MAX(trace_frames, 1);
+        }
+    }
+
     init_all();
 
+    render_thread_start();
+
+    // the render thread fills the buffers, this loop only handles input and vsync
     while(!glfwWindowShouldClose((GLFWwindow*)gc.window))
     {
         gc.dt = get_time_difference(&gc.last_frame_start);
 
-        gc.frame_history[gc.frame_idx] = gc.dt;
-        gc.frame_idx = (gc.frame_idx + 1) % FRAME_HISTORY_SIZE;
-        
-        // Calculate average frame time
-        f64 totalTime = 0.0;
-        for (int i = 0; i < FRAME_HISTORY_SIZE; i++) {
-            totalTime += gc.frame_history[i];
-        }
-        gc.average_frame_time = totalTime / FRAME_HISTORY_SIZE;
-        gc.current_fps = (gc.average_frame_time > 0.0) ? (1.0 / gc.average_frame_time) : 0.0;
-
         poll_events();
         
         animation_update(gc.dt);
 
-        // PROFILE("Rendering all single threaded")
-        // {
-        //     render_all();
-        // }
-
-        PROFILE("Rendering all multithreaded")
-        {
-            render_all_parallel();
-        }
+        present_latest_frame();
+    }
 
-        present_frame(&gc.draw_buffer);
+    render_thread_stop();
+    destroy_framebuffer();
 
-        arena_reset(gc.frame_arena);
+    thread_pool_destroy(&gc.thread_pool);
+    free(worker_idle_labels);
 
-        prof_sort_results();
-        prof_record_results();
-        prof_print_results();
-        prof_reset();
-    }
     return 0;
 }
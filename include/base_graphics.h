@@ -112,11 +112,11 @@ extern bool scissor_enabled;
 
 color4_t to_color4(vec3f_t const c);
 vec3f_t linear_to_gamma(vec3f_t color);
-inline void set_pixel(image_view_t const *img, i32 x, i32 y, color4_t color);
-inline color4_t get_pixel(image_view_t const *img, i32 x, i32 y);
-inline color4_t blend_pixel(color4_t dst, color4_t src);
-inline void set_pixel_blend(image_view_t const *img, i32 x, i32 y, color4_t color);
-inline void set_pixel_weighted(image_view_t *img, i32 x, i32 y, color4_t color, i8 weight);
+void set_pixel(image_view_t const *img, i32 x, i32 y, color4_t color);
+color4_t get_pixel(image_view_t const *img, i32 x, i32 y);
+color4_t blend_pixel(color4_t dst, color4_t src);
+void set_pixel_blend(image_view_t const *img, i32 x, i32 y, color4_t color);
+void set_pixel_weighted(image_view_t *img, i32 x, i32 y, color4_t color, i8 weight);
 void draw_pixel(image_view_t *img, i32 x, i32 y, color4_t color);
 void clear_screen(image_view_t const *color_buf, color4_t const color);
 void draw_hline(image_view_t const *color_buf, i32 y, i32 x0, i32 x1, color4_t const color);
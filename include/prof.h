@@ -15,12 +15,60 @@
     #include <unistd.h>
 #endif
 
+/*
+    Zones are timed with the time stamp counter where there is one: a single rdtsc on
+    entry and exit, converted to ms only when the results are merged or written.
+    Every core of a CPU with an invariant TSC ticks at the same rate, the rate is
+    measured against the OS clock in prof_init().
+*/
+#if defined(_M_X64) || defined(_M_IX86)
+    #include <intrin.h>
+    #define PROF_USE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define PROF_USE_TSC
+#endif
+
 #ifndef PROF_H_INCLUDE_
 #define PROF_H_INCLUDE_
 
 #define SIZE 10000000
 #define MAX_PROFILE_ENTRIES 1024
+#define MAX_PROFILE_THREADS 256
+#define PROF_TRACE_CAPACITY (1 << 16)   // events kept per thread while tracing, a power of two
+
+// single writer counters, a plain load and store is enough for the owner and the reader never tears
+#ifdef _MSC_VER
+    #define PROF_LOAD(ptr)              (*(volatile uint64_t *)(ptr))
+    #define PROF_STORE(ptr, v)          (*(volatile uint64_t *)(ptr) = (v))
+    #define PROF_LOAD_INT(ptr)          (int)InterlockedOr((volatile LONG *)(ptr), 0)
+    #define PROF_STORE_INT(ptr, v)      (void)InterlockedExchange((volatile LONG *)(ptr), (LONG)(v))
+    #define PROF_FETCH_ADD_INT(ptr, v)  (int)InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(v))
+    #define PROF_CAS_INT(ptr, old, v)   (InterlockedCompareExchange((volatile LONG *)(ptr), (LONG)(v), (LONG)(old)) == (LONG)(old))
+    #define PROF_LOAD_PTR(ptr)          InterlockedCompareExchangePointer((PVOID volatile *)(ptr), NULL, NULL)
+    #define PROF_STORE_PTR(ptr, v)      (void)InterlockedExchangePointer((PVOID volatile *)(ptr), (PVOID)(v))
+    #define PROF_THREAD_LOCAL           __declspec(thread)
+#else
+    #define PROF_LOAD(ptr)              __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define PROF_STORE(ptr, v)          __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+    #define PROF_LOAD_INT(ptr)          __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define PROF_STORE_INT(ptr, v)      __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+    #define PROF_FETCH_ADD_INT(ptr, v)  __atomic_fetch_add((ptr), (v), __ATOMIC_ACQ_REL)
+    #define PROF_CAS_INT(ptr, old, v)   prof_cas_int((ptr), (old), (v))
+    #define PROF_LOAD_PTR(ptr)          __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define PROF_STORE_PTR(ptr, v)      __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+    #define PROF_THREAD_LOCAL           _Thread_local
+
+    static inline int prof_cas_int(int *ptr, int expected, int desired)
+    {
+        return __atomic_compare_exchange_n(ptr, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+#endif
 
+/*
+    Define PROF_DISABLED to compile every PROFILE zone out, the block under it runs as a plain
+    block. The rest of the API stays so the code reporting the results doesn't change.
+*/
 #define DEFER(begin, end) \
     for(int _defer_ = ((begin), 0); !_defer_; _defer_ = 1, (end))
 
@@ -29,8 +77,13 @@
 
 typedef struct {
     const char* label;
-    double elapsed_ms;
+    double elapsed_ms;  // inclusive, zones nested inside count too
+    double self_ms;     // elapsed_ms minus the zones nested inside
     uint64_t hit_count; // how many times the same block was profiled
+    uint64_t value;     // sum of the prof_count() calls, printed instead of the time
+    int is_counter;
+    int parent;         // index of the enclosing zone's entry, -1 at the top
+    int depth;
 } prof_entry;
 
 typedef struct {
@@ -38,36 +91,131 @@ typedef struct {
     int count;
 } prof_storage;
 
+/*
+    What one thread measured since it started. Every zone is a node of a call tree,
+    the same PROFILE site reached under two different parents is two nodes.
+    zone_id and the links are set once before node_count is published, the times
+    are single writer counters.
+*/
+typedef struct {
+    int zone_id;
+    int parent;
+    int first_child;
+    int next_sibling;
+    uint64_t elapsed_ticks;
+    uint64_t child_ticks;   // time spent in the nodes below
+    uint64_t hit_count;
+} prof_thread_node;
+
+typedef struct {
+    uint64_t elapsed_ticks;
+    uint64_t child_ticks;
+    uint64_t hit_count;
+} prof_node_totals;
+
+// one zone as it ran, for the timeline, zone_id -1 marks the end of a frame
+typedef struct {
+    uint64_t start_time;
+    uint64_t end_time;
+    int zone_id;
+} prof_trace_event;
+
+typedef struct {
+    prof_thread_node nodes[MAX_PROFILE_ENTRIES];
+    int node_count;
+    int first_root;
+    int current;                                        // innermost open zone, -1 outside of any
+
+    // only the merging thread touches these
+    prof_node_totals merged[MAX_PROFILE_ENTRIES];       // totals at the last prof_merge()
+    int merged_entry[MAX_PROFILE_ENTRIES];              // entry of g_prof_storage each node went to
+
+    // ring of the last PROF_TRACE_CAPACITY zones, allocated the first time the thread traces
+    prof_trace_event *trace;
+    uint64_t trace_head;                                // events ever written, published after the event
+
+    int in_use;                                         // 0 once the owner released it, the next new thread takes it over
+} prof_thread_storage;
+
 typedef struct {
     uint64_t start_time;
-    int entry_index;
+    int entry_index;    // zone id
+    int node;           // node in the thread's call tree
 } prof_zone;
 
-// Global storage for profile results
+/*
+    Global storage for profile results, filled by prof_merge(), prof_record() and prof_count()
+    from the one thread that reports them.
+
+    PROFILE zones can run on any thread: each thread adds to its own prof_thread_storage
+    without synchronization, the zone ids come from a lock free registry of zone labels.
+    prof_merge() adds what every thread measured since the last merge to g_prof_storage,
+    zones with the same label under the same parent end up in the same entry.
+
+    Zones nest: every entry has an inclusive and a self time and a parent, and after
+    prof_sort_results() the entries are in tree order (children right after their parent,
+    heaviest first) with depth set for indenting.
+*/
 extern prof_storage g_prof_storage;
 
 /*
-    Get the number of OS ticks-per-second
+    Get the number of ticks-per-second of prof_get_time(), calibrated by prof_init()
 */
 static uint64_t prof_get_timer_freq(void);
 
 /*
-    Get the time elapsed since the last reset in nanoseconds
+    Get the current time in raw ticks, TSC cycles or OS counter ticks
 */
 static uint64_t prof_get_time(void);
 
-void prof_block_start(prof_zone* zone, const char* name, int counter_id);
+void prof_block_start(prof_zone* zone, const char* name, int *zone_id);
 void prof_block_end(prof_zone* zone);
 
-// Functions to manage the global profile storage
+/*
+    Called by a thread that is about to exit, outside of any zone. Its storage stays with
+    what it measured and is handed to the next thread that profiles, so threads that come
+    and go (a thread pool per run) don't run out of the MAX_PROFILE_THREADS slots.
+*/
+void prof_thread_release(void);
+
+/*
+    Add a time that was measured elsewhere (e.g on another thread) under its own label
+    at the top of the tree, entries are matched by label so repeated calls in a frame accumulate.
+*/
+void prof_record(const char* name, double elapsed_ms);
+
+/*
+    Same as prof_record() for a quantity that isn't a time (rays, bounces ...),
+    the values of a frame are summed and printed as a count.
+*/
+void prof_count(const char* name, uint64_t value);
+
+/*
+    Timeline of the zones for chrome://tracing or ui.perfetto.dev. Off by default, once started
+    every PROFILE zone on every thread also logs when it began and ended, and after the
+    given number of calls to prof_trace_frame() the window is written as Chrome trace_event JSON.
+    Both are called from the thread that reports, between frames: the last prof_trace_frame()
+    reads the ring of every thread, so no other thread may be inside a zone while it runs.
+*/
+void prof_trace_start(const char* path, int frames);
+void prof_trace_frame(void);
+int  prof_trace_active(void);
+
+// Functions to manage the global profile storage, prof_init() also calibrates the timer
 void prof_init(void);
+void prof_merge(void);
 void prof_reset(void);
 void prof_print_results(void);
 void prof_sort_results(void);
 
-#define PROFILE(name) \
-    prof_zone CONCAT_AUX(_prof_, __LINE__); \
-    DEFER(prof_block_start(&CONCAT_AUX(_prof_, __LINE__), name, __COUNTER__), prof_block_end(&CONCAT_AUX(_prof_, __LINE__)))
+#ifdef PROF_DISABLED
+    #define PROFILE(name)
+#else
+    #define PROFILE(name) \
+        static int CONCAT_AUX(_prof_id_, __LINE__) = -1; \
+        prof_zone CONCAT_AUX(_prof_, __LINE__); \
+        DEFER(prof_block_start(&CONCAT_AUX(_prof_, __LINE__), name, &CONCAT_AUX(_prof_id_, __LINE__)), prof_block_end(&CONCAT_AUX(_prof_, __LINE__)))
+#endif
 
 #endif
 
@@ -76,7 +224,25 @@ void prof_sort_results(void);
 // Global storage definition
 prof_storage g_prof_storage = {0};
 
-static uint64_t prof_get_timer_freq(void) 
+#define PROF_CALIBRATION_NS 10000000ULL    // how long prof_init() watches the TSC against the OS clock
+
+static uint64_t g_prof_timer_freq;
+
+// OS clock in its own ticks, the TSC is calibrated against it
+static uint64_t prof_get_os_time(void)
+{
+    #ifdef _WIN32
+        LARGE_INTEGER Value;
+        QueryPerformanceCounter(&Value);
+        return Value.QuadPart;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return 1000000000ULL * (uint64_t)ts.tv_sec + (uint64_t)ts.tv_nsec;
+    #endif
+}
+
+static uint64_t prof_get_os_timer_freq(void)
 {
     #ifdef _WIN32
         LARGE_INTEGER Freq;
@@ -87,107 +253,510 @@ static uint64_t prof_get_timer_freq(void)
     #endif
 }
 
+static uint64_t prof_get_timer_freq(void) 
+{
+    return g_prof_timer_freq;
+}
+
 static uint64_t prof_get_time(void) 
 {
-    #ifdef _WIN32
-        LARGE_INTEGER Value;
-        QueryPerformanceCounter(&Value);
-        // We know the time of a single tick in seconds we just convert it to nanoseconds
-        // and multiply by the number of elapsed ticks
-        uint64_t elapsed_ns = Value.QuadPart * 1000000000ULL;
-        elapsed_ns /= prof_get_timer_freq();
-        return elapsed_ns;
+    #ifdef PROF_USE_TSC
+        return __rdtsc();
     #else
-        struct timespec ts;
-        clock_gettime(CLOCK_MONOTONIC, &ts);
-        
-        uint64_t result = prof_get_timer_freq() * (uint64_t)ts.tv_sec + (uint64_t)ts.tv_nsec;
-        return result;
+        return prof_get_os_time();
     #endif
 }
 
-void prof_block_start(prof_zone* zone, const char* name, int counter_id) 
+static void prof_calibrate_timer(void)
 {
-    zone->start_time = prof_get_time();
-    
-    // Use counter_id as direct index (each PROFILE call gets unique counter)
-    if (counter_id < MAX_PROFILE_ENTRIES) 
+    #ifdef PROF_USE_TSC
+        uint64_t os_freq  = prof_get_os_timer_freq();
+        uint64_t os_wait  = os_freq * PROF_CALIBRATION_NS / 1000000000ULL;
+        uint64_t os_start = prof_get_os_time();
+        uint64_t start    = prof_get_time();
+
+        uint64_t os_end = os_start;
+        while (os_end - os_start < os_wait) {
+            os_end = prof_get_os_time();
+        }
+        uint64_t end = prof_get_time();
+
+        g_prof_timer_freq = (uint64_t)((double)(end - start) * (double)os_freq / (double)(os_end - os_start));
+    #else
+        g_prof_timer_freq = prof_get_os_timer_freq();
+    #endif
+}
+
+static double prof_ticks_to_ms(uint64_t ticks)
+{
+    return (double)ticks * 1000.0 / (double)g_prof_timer_freq;
+}
+
+static const char* g_prof_labels[MAX_PROFILE_ENTRIES];
+static int g_prof_label_count;
+
+static prof_thread_storage* g_prof_threads[MAX_PROFILE_THREADS];
+static int g_prof_thread_count;
+
+static PROF_THREAD_LOCAL prof_thread_storage* t_prof_thread;
+
+static int g_prof_trace_frames;         // frames left in the trace window, 0 when not tracing
+static char g_prof_trace_path[1024];
+static uint64_t g_prof_trace_start;
+
+// first time a PROFILE site runs, gives it an id, racing threads agree on one of theirs
+static int prof_register_zone(const char* name, int *zone_id)
+{
+    int id = PROF_FETCH_ADD_INT(&g_prof_label_count, 1);
+    if (id >= MAX_PROFILE_ENTRIES) {
+        return -1;
+    }
+    // a site that lost the race leaves its id without a label, prof_merge() skips it
+    if (PROF_CAS_INT(zone_id, -1, id)) {
+        PROF_STORE_PTR(&g_prof_labels[id], name);
+    }
+    return PROF_LOAD_INT(zone_id);
+}
+
+/*
+    The storage lives as long as the program. A thread takes over the storage of one that
+    released it if there is one, it keeps adding to the same nodes so prof_merge() carries on
+    from the totals it already has, and only gets a new slot otherwise.
+*/
+static prof_thread_storage* prof_thread_register(void)
+{
+    int thread_count = PROF_LOAD_INT(&g_prof_thread_count);
+    if (thread_count > MAX_PROFILE_THREADS) thread_count = MAX_PROFILE_THREADS;
+
+    for (int t = 0; t < thread_count; t++)
     {
-        zone->entry_index = counter_id;
-        
-        // Initialize entry if first time
-        if (g_prof_storage.entries[counter_id].hit_count == 0) 
-        {
-            g_prof_storage.entries[counter_id].label = name;
-            g_prof_storage.entries[counter_id].elapsed_ms = 0.0;
-            g_prof_storage.entries[counter_id].hit_count = 0;
-            
-            // Update count to track highest used index
-            if (counter_id >= g_prof_storage.count) {
-                g_prof_storage.count = counter_id + 1;
-            }
+        prof_thread_storage *storage = (prof_thread_storage *)PROF_LOAD_PTR(&g_prof_threads[t]);
+        if (storage && PROF_CAS_INT(&storage->in_use, 0, 1)) {
+            return storage;
+        }
+    }
+
+    int slot = PROF_FETCH_ADD_INT(&g_prof_thread_count, 1);
+    if (slot >= MAX_PROFILE_THREADS) {
+        return NULL;
+    }
+
+    prof_thread_storage *storage = calloc(1, sizeof(prof_thread_storage));
+    if (storage)
+    {
+        storage->first_root = -1;
+        storage->current    = -1;
+        storage->in_use     = 1;
+    }
+    PROF_STORE_PTR(&g_prof_threads[slot], storage);
+
+    return storage;
+}
+
+void prof_thread_release(void)
+{
+    if (t_prof_thread)
+    {
+        PROF_STORE_INT(&t_prof_thread->in_use, 0);
+        t_prof_thread = NULL;
+    }
+}
+
+/*
+    Only the owning thread writes its ring and the head moves past an event once it is complete.
+    That alone doesn't make reading safe: an owner that keeps logging laps the ring and overwrites
+    the slots being read, hence prof_trace_write() only runs while the other threads are idle.
+*/
+static void prof_trace_push(prof_thread_storage* thread, int zone_id, uint64_t start_time, uint64_t end_time)
+{
+    if (!thread->trace)
+    {
+        prof_trace_event *events = malloc(PROF_TRACE_CAPACITY * sizeof(prof_trace_event));
+        if (!events) {
+            return;
         }
-    } 
-    else 
+        PROF_STORE_PTR(&thread->trace, events);
+    }
+
+    uint64_t head = PROF_LOAD(&thread->trace_head);
+    thread->trace[head & (PROF_TRACE_CAPACITY - 1)] = (prof_trace_event){start_time, end_time, zone_id};
+    PROF_STORE(&thread->trace_head, head + 1);
+}
+
+// node for zone_id under parent, added the first time the zone opens there
+static int prof_thread_child(prof_thread_storage* thread, int parent, int zone_id)
+{
+    int *link = (parent >= 0) ? &thread->nodes[parent].first_child : &thread->first_root;
+
+    while (*link >= 0)
     {
-        zone->entry_index = -1; // Invalid index
+        if (thread->nodes[*link].zone_id == zone_id) {
+            return *link;
+        }
+        link = &thread->nodes[*link].next_sibling;
+    }
+
+    int node = thread->node_count;
+    if (node >= MAX_PROFILE_ENTRIES) {
+        return -1;
     }
+
+    thread->nodes[node] = (prof_thread_node){
+        .zone_id = zone_id, .parent = parent, .first_child = -1, .next_sibling = -1
+    };
+    *link = node;
+    PROF_STORE_INT(&thread->node_count, node + 1);
+
+    return node;
+}
+
+void prof_block_start(prof_zone* zone, const char* name, int *zone_id) 
+{
+    int id = PROF_LOAD_INT(zone_id);
+    if (id < 0) {
+        id = prof_register_zone(name, zone_id);
+    }
+
+    if (!t_prof_thread) {
+        t_prof_thread = prof_thread_register();
+    }
+
+    zone->entry_index = -1;
+    zone->node        = -1;
+
+    if (t_prof_thread && id >= 0)
+    {
+        zone->entry_index = id;
+        zone->node        = prof_thread_child(t_prof_thread, t_prof_thread->current, id);
+        if (zone->node >= 0) {
+            t_prof_thread->current = zone->node;
+        }
+    }
+
+    zone->start_time = prof_get_time();
 }
 
 void prof_block_end(prof_zone* zone) 
 {
     uint64_t end_time = prof_get_time();
-    double elapsed_ns = (double)(end_time - zone->start_time);
-    double elapsed_ms = elapsed_ns / 1000000.0;
-    
-    // Update the corresponding entry
-    if (zone->entry_index >= 0 && zone->entry_index < MAX_PROFILE_ENTRIES) {
-        g_prof_storage.entries[zone->entry_index].elapsed_ms += elapsed_ms;
-        g_prof_storage.entries[zone->entry_index].hit_count++;
+
+    if (zone->node < 0) {
+        return;
+    }
+
+    uint64_t elapsed_ticks = end_time - zone->start_time;
+
+    prof_thread_node *node = &t_prof_thread->nodes[zone->node];
+    PROF_STORE(&node->elapsed_ticks, PROF_LOAD(&node->elapsed_ticks) + elapsed_ticks);
+    PROF_STORE(&node->hit_count,  PROF_LOAD(&node->hit_count) + 1);
+
+    if (node->parent >= 0)
+    {
+        prof_thread_node *parent = &t_prof_thread->nodes[node->parent];
+        PROF_STORE(&parent->child_ticks, PROF_LOAD(&parent->child_ticks) + elapsed_ticks);
+    }
+    t_prof_thread->current = node->parent;
+
+    if (PROF_LOAD_INT(&g_prof_trace_frames) > 0) {
+        prof_trace_push(t_prof_thread, zone->entry_index, zone->start_time, end_time);
+    }
+}
+
+static int prof_find_entry(int parent, const char* name)
+{
+    int index = -1;
+
+    for (int i = 0; i < g_prof_storage.count; i++) 
+    {
+        if (g_prof_storage.entries[i].parent == parent && 
+            strcmp(g_prof_storage.entries[i].label, name) == 0) 
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if (index < 0) 
+    {
+        if (g_prof_storage.count >= MAX_PROFILE_ENTRIES) {
+            return -1;
+        }
+        index = g_prof_storage.count++;
+        g_prof_storage.entries[index] = (prof_entry){.label = name, .parent = parent};
+    }
+
+    return index;
+}
+
+void prof_record(const char* name, double elapsed_ms)
+{
+    int index = prof_find_entry(-1, name);
+    if (index < 0) {
+        return;
+    }
+
+    g_prof_storage.entries[index].elapsed_ms += elapsed_ms;
+    g_prof_storage.entries[index].self_ms    += elapsed_ms;
+    g_prof_storage.entries[index].hit_count++;
+}
+
+void prof_count(const char* name, uint64_t value)
+{
+    int index = prof_find_entry(-1, name);
+    if (index < 0) {
+        return;
     }
+
+    g_prof_storage.entries[index].value += value;
+    g_prof_storage.entries[index].is_counter = 1;
+    g_prof_storage.entries[index].hit_count++;
 }
 
 void prof_init(void) 
 {
     memset(&g_prof_storage, 0, sizeof(g_prof_storage));
+    prof_calibrate_timer();
+}
+
+void prof_merge(void)
+{
+    int thread_count = PROF_LOAD_INT(&g_prof_thread_count);
+    if (thread_count > MAX_PROFILE_THREADS) thread_count = MAX_PROFILE_THREADS;
+
+    for (int t = 0; t < thread_count; t++)
+    {
+        prof_thread_storage *thread = (prof_thread_storage *)PROF_LOAD_PTR(&g_prof_threads[t]);
+        if (!thread) {
+            continue;
+        }
+
+        // nodes are added after their parent, so the parent's entry is always known first
+        int node_count = PROF_LOAD_INT(&thread->node_count);
+
+        for (int n = 0; n < node_count; n++)
+        {
+            prof_thread_node *node   = &thread->nodes[n];
+            prof_node_totals *merged = &thread->merged[n];
+            const char *label = (const char *)PROF_LOAD_PTR(&g_prof_labels[node->zone_id]);
+
+            int parent = (node->parent >= 0) ? thread->merged_entry[node->parent] : -1;
+            int index  = (label && (node->parent < 0 || parent >= 0)) ? prof_find_entry(parent, label) : -1;
+            thread->merged_entry[n] = index;
+
+            // hits first, a zone ending in between shows up next merge
+            uint64_t hits       = PROF_LOAD(&node->hit_count);
+            uint64_t elapsed_ticks = PROF_LOAD(&node->elapsed_ticks);
+            uint64_t child_ticks   = PROF_LOAD(&node->child_ticks);
+
+            if (index >= 0)
+            {
+                double elapsed_ms = prof_ticks_to_ms(elapsed_ticks - merged->elapsed_ticks);
+                double child_ms   = prof_ticks_to_ms(child_ticks - merged->child_ticks);
+
+                g_prof_storage.entries[index].elapsed_ms += elapsed_ms;
+                g_prof_storage.entries[index].self_ms    += elapsed_ms - child_ms;
+                g_prof_storage.entries[index].hit_count  += hits - merged->hit_count;
+            }
+
+            *merged = (prof_node_totals){elapsed_ticks, child_ticks, hits};
+        }
+    }
+}
+
+void prof_trace_start(const char* path, int frames)
+{
+    snprintf(g_prof_trace_path, sizeof(g_prof_trace_path), "%s", path);
+    g_prof_trace_start = prof_get_time();
+
+    // zones that already started before this are left out of the window
+    #ifdef _MSC_VER
+        InterlockedExchange((volatile LONG *)&g_prof_trace_frames, frames);
+    #else
+        __atomic_store_n(&g_prof_trace_frames, frames, __ATOMIC_RELEASE);
+    #endif
+}
+
+static void prof_trace_write(void)
+{
+    FILE *file = fopen(g_prof_trace_path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", g_prof_trace_path);
+        return;
+    }
+
+    int thread_count = PROF_LOAD_INT(&g_prof_thread_count);
+    if (thread_count > MAX_PROFILE_THREADS) thread_count = MAX_PROFILE_THREADS;
+
+    uint64_t event_count = 0;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"RayTracer\"}}");
+
+    for (int t = 0; t < thread_count; t++)
+    {
+        prof_thread_storage *thread = (prof_thread_storage *)PROF_LOAD_PTR(&g_prof_threads[t]);
+        prof_trace_event *events = thread ? (prof_trace_event *)PROF_LOAD_PTR(&thread->trace) : NULL;
+        if (!events) {
+            continue;
+        }
+
+        fprintf(file, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"Thread %d\"}}", t, t);
+
+        // the oldest events of a thread that logged more than the ring holds are gone,
+        // the owner is idle between frames so nothing moves past this head while reading
+        uint64_t head  = PROF_LOAD(&thread->trace_head);
+        uint64_t first = (head > PROF_TRACE_CAPACITY) ? head - PROF_TRACE_CAPACITY : 0;
+
+        for (uint64_t i = first; i < head; i++)
+        {
+            prof_trace_event *event = &events[i & (PROF_TRACE_CAPACITY - 1)];
+            if (event->start_time < g_prof_trace_start) {
+                continue;
+            }
+
+            double ts_us = prof_ticks_to_ms(event->start_time - g_prof_trace_start) * 1000.0;
+
+            if (event->zone_id < 0)
+            {
+                fprintf(file, ",\n  {\"name\": \"Frame\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f}", t, ts_us);
+            }
+            else
+            {
+                const char *label = (const char *)PROF_LOAD_PTR(&g_prof_labels[event->zone_id]);
+                fprintf(file, ",\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        label ? label : "?", t, ts_us, prof_ticks_to_ms(event->end_time - event->start_time) * 1000.0);
+            }
+            event_count++;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Wrote %llu trace events to %s\n", (unsigned long long)event_count, g_prof_trace_path);
+}
+
+int prof_trace_active(void)
+{
+    return PROF_LOAD_INT(&g_prof_trace_frames) > 0;
+}
+
+void prof_trace_frame(void)
+{
+    int frames = PROF_LOAD_INT(&g_prof_trace_frames);
+    if (frames <= 0) {
+        return;
+    }
+
+    if (!t_prof_thread) {
+        t_prof_thread = prof_thread_register();
+    }
+    if (t_prof_thread)
+    {
+        uint64_t now = prof_get_time();
+        prof_trace_push(t_prof_thread, -1, now, now);
+    }
+
+    PROF_FETCH_ADD_INT(&g_prof_trace_frames, -1);
+
+    if (frames == 1) {
+        prof_trace_write();
+    }
 }
 
 void prof_reset(void) 
 {
-    memset(&g_prof_storage, 0, sizeof(g_prof_storage));
+    memset(g_prof_storage.entries, 0, g_prof_storage.count * sizeof(prof_entry));
     g_prof_storage.count = 0;
 }
 
-// Comparison function for sorting (descending order by time)
+// Comparison function for sorting entry indices (ascending order by time)
 static int prof_compare(const void* a, const void* b) 
 {
-    const prof_entry* entry_a = (const prof_entry*)a;
-    const prof_entry* entry_b = (const prof_entry*)b;
-    
-    // Skip empty entries
-    if (entry_a->hit_count == 0 && entry_b->hit_count == 0) return 0;
-    if (entry_a->hit_count == 0) return 1;
-    if (entry_b->hit_count == 0) return -1;
+    const prof_entry* entry_a = &g_prof_storage.entries[*(const int*)a];
+    const prof_entry* entry_b = &g_prof_storage.entries[*(const int*)b];
     
-    if (entry_a->elapsed_ms > entry_b->elapsed_ms) return -1;
-    if (entry_a->elapsed_ms < entry_b->elapsed_ms) return 1;
-    return 0;
+    if (entry_a->elapsed_ms < entry_b->elapsed_ms) return -1;
+    if (entry_a->elapsed_ms > entry_b->elapsed_ms) return 1;
+    return *(const int*)b - *(const int*)a;   // ties come out in the order they were recorded
 }
 
+/*
+    Puts the entries in tree order: every entry is followed by its children, heaviest first.
+    Subtrees nothing was recorded in this frame (zones of an earlier frame) are dropped.
+*/
 void prof_sort_results(void) 
 {
-    qsort(g_prof_storage.entries, g_prof_storage.count, sizeof(prof_entry), prof_compare);
+    static uint64_t   subtree_hits[MAX_PROFILE_ENTRIES];
+    static int        order[MAX_PROFILE_ENTRIES];
+    static int        moved_to[MAX_PROFILE_ENTRIES];
+    static prof_entry sorted[MAX_PROFILE_ENTRIES];
+
+    int count = g_prof_storage.count;
+
+    // children always come after their parent, so one backward pass sums the subtrees
+    for (int i = 0; i < count; i++) {
+        subtree_hits[i] = g_prof_storage.entries[i].hit_count;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        int parent = g_prof_storage.entries[i].parent;
+        if (parent >= 0) subtree_hits[parent] += subtree_hits[i];
+    }
+
+    /*
+        Depth first: order[] is used as a stack of entries still to output, the children
+        of an entry are pushed sorted lightest first so the heaviest pops first.
+    */
+    int top = 0;
+    int sorted_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (g_prof_storage.entries[i].parent < 0 && subtree_hits[i] > 0) order[top++] = i;
+    }
+    qsort(order, top, sizeof(int), prof_compare);
+
+    while (top > 0)
+    {
+        int index = order[--top];
+        prof_entry *entry = &g_prof_storage.entries[index];
+
+        moved_to[index] = sorted_count;
+        sorted[sorted_count] = *entry;
+        sorted[sorted_count].parent = (entry->parent >= 0) ? moved_to[entry->parent] : -1;
+        sorted[sorted_count].depth  = (entry->parent >= 0) ? sorted[moved_to[entry->parent]].depth + 1 : 0;
+        sorted_count++;
+
+        int first = top;
+        for (int i = index + 1; i < count; i++) {
+            if (g_prof_storage.entries[i].parent == index && subtree_hits[i] > 0) order[top++] = i;
+        }
+        qsort(&order[first], top - first, sizeof(int), prof_compare);
+    }
+
+    memcpy(g_prof_storage.entries, sorted, sorted_count * sizeof(prof_entry));
+    g_prof_storage.count = sorted_count;
 }
 
 void prof_print_results(void) 
 {
     printf("\n=== Profile Results ===\n");
     for (int i = 0; i < g_prof_storage.count; i++) {
-        if (g_prof_storage.entries[i].hit_count > 0) {
-            printf("[PROFILE] %s[%llu]: %.6f ms (total)\n", 
+        if (g_prof_storage.entries[i].hit_count == 0) {
+            continue;
+        }
+        if (g_prof_storage.entries[i].is_counter) {
+            printf("[PROFILE] %*s%s[%llu]: %llu (total)\n", 
+                   2 * g_prof_storage.entries[i].depth, "",
+                   g_prof_storage.entries[i].label,
+                   (unsigned long long)g_prof_storage.entries[i].hit_count,
+                   (unsigned long long)g_prof_storage.entries[i].value);
+        } else {
+            printf("[PROFILE] %*s%s[%llu]: %.6f ms (total), %.6f ms (self)\n", 
+                   2 * g_prof_storage.entries[i].depth, "",
                    g_prof_storage.entries[i].label,
                    (unsigned long long)g_prof_storage.entries[i].hit_count,
-                   g_prof_storage.entries[i].elapsed_ms);
+                   g_prof_storage.entries[i].elapsed_ms,
+                   g_prof_storage.entries[i].self_ms);
         }
     }
     printf("=======================\n");
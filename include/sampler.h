@@ -0,0 +1,58 @@
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include "util.h"
+
+/*
+    Source of the random numbers a path consumes. Every number is addressed by
+    (pixel, sample index, dimension) so samplers can place the samples of a pixel
+    so they cover the domain evenly instead of drawing independent white noise.
+
+    Dimensions are laid out the same for every sampler:
+
+        0, 1                pixel jitter
+        2, 3                lens
+        bounce b >= 1       SAMPLER_CAMERA_DIMS + (b - 1) * SAMPLER_BOUNCE_DIMS ...
+
+    Usage:
+        sampler_start(&s, SamplerSobol, x, y, pixel, sample, spp, seed);
+        sampler_get_2d(&s, &u1, &u2);           // pixel jitter
+        sampler_set_bounce(&s, 1);
+        sampler_get_2d(&s, &u1, &u2);           // first scatter direction
+*/
+
+enum sampler_type
+{
+    SamplerRandom,          // independent white noise
+    SamplerStratified,      // jittered grid of spp cells, shuffled per pixel and dimension
+    SamplerSobol,           // Owen scrambled Sobol pairs (Burley 2020)
+    SamplerBlueNoise,       // one Sobol sequence for the image, rotated per pixel by a blue noise mask
+    SamplerTypeCount
+};
+
+#define SAMPLER_CAMERA_DIMS     4
+#define SAMPLER_BOUNCE_DIMS     8
+
+typedef struct sampler_t
+{
+    enum sampler_type   type;
+    u32                 x, y;
+    u32                 key;        // hash of the pixel and the seed
+    u32                 seed;
+    u32                 sample;
+    u32                 spp;        // samples the pixel is expected to take, sizes the strata
+    u32                 grid;       // side of the 2D strata grid, ceil(sqrt(spp))
+    u32                 dimension;
+    rng_t               rng;        // white noise for SamplerRandom and the jitter inside strata
+    u32                 batch_next;
+    f32                 batch[SAMPLER_BOUNCE_DIMS]; // the next rng numbers of the bounce, drawn 8 at a time
+}sampler_t;
+
+extern const char *sampler_names[SamplerTypeCount];
+
+void sampler_start(sampler_t *sampler, enum sampler_type type, u32 x, u32 y, u32 pixel, u32 sample, u32 spp, u32 seed);
+void sampler_set_bounce(sampler_t *sampler, u32 bounce);
+f32  sampler_get_1d(sampler_t *sampler);
+void sampler_get_2d(sampler_t *sampler, f32 *u1, f32 *u2);
+
+#endif
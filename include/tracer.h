@@ -0,0 +1,406 @@
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include "util.h"
+#include "arena.h"
+#include "base_graphics.h"
+#include "sampler.h"
+
+typedef struct ray_t
+{
+    vec3f_t  orig;
+    vec3f_t  dir;
+}ray_t;
+
+#define RAY_AT(r,t) vec3f_add(r->orig, vec3f_scale(r->dir, t)) 
+
+typedef struct camera_t
+{
+    vec3f_t pos;
+    vec3f_t target;
+    vec3f_t up;
+    
+    vec3f_t u;
+    vec3f_t v;
+    vec3f_t w;
+
+    f32 vfov;
+    f32 speed;
+
+    f32 defocus_angle;
+    f32 focus_dist;
+
+    vec3f_t defocus_disk_u;
+    vec3f_t defocus_disk_v;
+
+}camera_t;
+
+enum material_type
+{
+    Lambertian,     // Perfectly diffuse light ?
+    Metal,     
+    Dielectric,     // Glass like
+    Emissive,       
+    MaterialTypeCount
+};
+
+typedef struct material_t
+{
+    enum material_type mat_type;
+    vec3f_t albedo;                 // whiteness
+    f32 fuzz;                       // Lambertian
+    f32 refraction_index;           // Dielectric
+    vec3f_t emission;               // Emissive, radiance leaving the front face
+}material_t;
+
+/*
+    Materials are stored once per scene and referenced by index,
+    any number of objects can share one and hit records stay small.
+*/
+typedef struct material_table_t
+{
+    material_t *items;
+    u32         count;
+    u32         capacity;
+}material_table_t;
+
+typedef struct hit_record_t
+{
+    vec3f_t hit_point;      
+    vec3f_t norm;
+    f32 hit_dist;
+    u32 mat_id;             // index into the scene material table
+    u32 prim_id;            // scene object that was hit
+    bool front_face;
+}hit_record_t;
+
+enum object_type{
+    Sphere
+};
+
+typedef struct sphere_t 
+{
+    vec3f_t     center;
+    f32         radius;
+    u32         mat_id;
+}sphere_t;
+
+/*
+    Per pixel accumulation state, the luminance sum of squares together with
+    the radiance sum gives the variance used by the adaptive sampler.
+*/
+typedef struct accum_pixel_t
+{
+    vec3f_t sum;        // running sum of linear radiance
+    f32     lum_sq;     // running sum of squared luminance
+    u32     count;      // samples taken so far
+}accum_pixel_t;
+
+#define ADAPTIVE_MAX_SPP_SCALE  4       // noisy pixels may take up to this many times samples_per_pixel
+
+#define ROULETTE_MAX_SURVIVAL   0.95f   // even paths that lose no energy (glass) end eventually
+
+#define TILE_SIZE               64
+#define TILE_PIXELS             (TILE_SIZE * TILE_SIZE)
+
+/*
+    Wavefront renderer state, one path per pixel of the tile in flight.
+    Paths go through intersection, miss shading and scatter as separate passes
+    over the whole queue and the survivors are compacted into the next queue.
+*/
+typedef struct path_state_t
+{
+    ray_t     ray;
+    vec3f_t   throughput;
+    sampler_t sampler;      // keyed on the pixel and sample, see sampler_start()
+    f32       bsdf_pdf;     // pdf ray was sampled with, 0 when light sampling could not have picked it
+    u32       pixel;        // index of the pixel inside the tile
+}path_state_t;
+
+typedef struct wavefront_t
+{
+    path_state_t  queues[2][TILE_PIXELS];
+    f32           hit_dist[TILE_PIXELS];    // closest hit of every path, before its surface is filled in
+    u32           hit_prim[TILE_PIXELS];
+    hit_record_t  hits[TILE_PIXELS];
+    bool          hit_mask[TILE_PIXELS];
+    u32           order[TILE_PIXELS];       // hit paths sorted by material type
+    vec3f_t       radiance[TILE_PIXELS];    // radiance of the current sample of every pixel
+    u32           samples[TILE_PIXELS];     // samples every pixel takes this frame
+}wavefront_t;
+
+typedef struct scene_object_t
+{
+    enum object_type type;
+    void *object;
+}scene_object_t;
+
+typedef struct aabb_t
+{
+    vec3f_t min;
+    vec3f_t max;
+}aabb_t;
+
+/*
+    Nodes are 32 bytes so two siblings share a cache line,
+    children are always allocated in pairs so only the left index is stored.
+*/
+typedef struct bvh_node_t
+{
+    aabb_t  bounds;
+    u32     left_first;     // left child index (interior) or first primitive index (leaf)
+    u32     count;          // number of primitives, 0 for interior nodes
+}bvh_node_t;
+
+typedef struct bvh_t
+{
+    bvh_node_t *nodes;
+    u32        *indices;    // leaf ranges index into scene_objects_t::objects through this
+    u32         node_count;
+    u32         capacity;   // in primitives
+}bvh_t;
+
+/*
+    Spheres packed in bvh leaf order as structure of arrays so a leaf is a
+    contiguous range that can be tested SPHERE_LANES at a time.
+    Arrays are padded by SPHERE_LANES-1 entries so the last group can be loaded whole.
+*/
+typedef struct sphere_soa_t
+{
+    f32 *center_x;
+    f32 *center_y;
+    f32 *center_z;
+    f32 *radius;
+    u32 *object;        // owning scene object
+    u32 *material;      // material id, copied so a hit never touches the sphere_t
+    u32  count;
+    u32  capacity;
+}sphere_soa_t;
+
+#define SPHERE_LANES        8
+
+#define BVH_BINS            16
+#define BVH_MAX_LEAF_SIZE   SPHERE_LANES
+#define BVH_MAX_DEPTH       64
+#define BVH_TRAVERSAL_COST  1.0f
+#define BVH_INTERSECT_COST  1.0f
+
+/*
+    Emissive spheres, collected when the bvh is built.
+    Light sampling picks one uniformly and samples the cone it subtends.
+*/
+typedef struct light_t
+{
+    vec3f_t center;
+    f32     radius;
+    u32     mat_id;
+}light_t;
+
+typedef struct scene_objects_t
+{
+    scene_object_t *objects;    
+    size_t count;               
+    size_t capacity;            
+
+    material_table_t materials;
+
+    light_t     *lights;
+    u32          light_count;
+    u32          light_capacity;
+    f32          sky_intensity;     // scales the sky gradient, night scenes turn it down
+
+    bvh_t        bvh;
+    sphere_soa_t spheres;       // leaf ranges of the bvh index into this
+    bool         bvh_dirty;     // set on add/remove, the bvh and spheres are rebuilt before the next frame
+} scene_objects_t;
+
+static inline material_t *scene_material(scene_objects_t *array, u32 mat_id)
+{
+    return &array->materials.items[mat_id];
+}
+
+enum scene_id
+{
+    SceneSpheres,       // ground and three large spheres
+    SceneRandomField,   // the large spheres among a 22x22 field of small random ones
+    SceneGlass,         // dense grid of glass spheres, long refraction heavy paths
+    SceneLights,        // the large spheres lit by small emissive ones under a night sky
+    SceneCount
+};
+
+#define SCENE_SEED          1337
+#define RENDER_SEED         0x9E3779B9u
+
+extern const char *scene_names[SceneCount];
+
+#define FRAME_HISTORY_SIZE  64
+#define BUFFER_SIZE         512
+
+/*
+    What the tracer did, every thread counts into its own copy while it runs a tile
+    and render_frame_end() adds up the tiles into gc.frame_stats.
+*/
+typedef struct {
+    u64 primary_rays;       // camera rays, one per sample
+    u64 secondary_rays;     // bounce and shadow rays
+    u64 bounces;            // path segments traced, camera rays included
+    u64 escaped;            // paths that left the scene and picked up the sky
+    u64 roulette_kills;     // paths ended by russian roulette
+    u64 sphere_tests;       // ray-sphere tests in the leaves, shadow rays included
+    u64 bvh_nodes;          // BVH nodes visited, shadow rays included
+    u32 max_path_depth;     // most segments a single path took
+} render_stats_t;
+
+typedef struct {
+    u32 start_x, end_x;
+    u32 start_y, end_y;
+    u32 width, height;
+    i32 samples;            // new samples per pixel this frame, 0 once converged
+    u32 max_samples;        // per pixel cap
+    u64 samples_taken;      // written back by the worker
+    render_stats_t stats;   // written back by the worker
+} tile_data_t;
+
+struct context_t
+{
+    void               *window;
+    u32                 screen_width;
+    u32                 screen_height;
+    image_view_t        draw_buffer;
+
+    u32                 texture;            // GL handles, unused by the tracer
+    u32                 read_fbo;
+
+    vec3f_t             pixel00_loc;
+    vec3f_t             pixel_delta_u;
+    vec3f_t             pixel_delta_v;
+
+    camera_t            camera;
+
+    i32                 samples_per_pixel;  // average sample budget per pixel
+    i32                 samples_per_frame;
+    i32                 max_depth;
+
+    /* Progressive accumulation */
+    accum_pixel_t      *accum_buffer;
+    u32                 accum_width;
+    u32                 accum_height;
+    u32                 accum_frames;       // frames accumulated since the last reset
+    u64                 accum_spent;        // samples taken since the last reset, over all pixels
+    bool                accum_converged;    // every pixel is either converged or at its cap
+    bool                accum_reset;
+
+    /* Adaptive sampling */
+    f32                 adaptive_error;         // relative standard error a pixel has to reach, 0 disables it
+    i32                 adaptive_min_samples;   // samples before a pixel's variance is trusted
+    bool                show_sample_count;      // debug view of the samples spent per pixel
+
+    bool                wavefront;              // trace with render_tile_wavefront()
+    bool                light_sampling;         // next event estimation at diffuse bounces
+    bool                russian_roulette;       // end dim paths early, see roulette_survives()
+    i32                 roulette_min_depth;     // bounces every path takes before roulette starts
+    enum sampler_type   sampler;                // where the pixel, lens and bounce samples come from
+
+    /* Frame in flight, between render_frame_begin() and render_frame_end() */
+    color4_t           *frame_target;           // pixels to render into, NULL takes them from the frame arena
+    u32                 frame_cancel;           // set with ATOMIC_STORE_U32, tiles still running stop early
+    tile_data_t        *tiles;
+    u32                 tile_count;
+    i32                 frame_samples;
+    render_stats_t      frame_stats;            // totals of the last finished frame
+
+    scene_objects_t     *scene_objects;
+
+    u32                 mouseX;
+    u32                 mouseLastX;
+    u32                 mouseY;
+    u32                 mouseLastY;
+    bool                firstMouse;
+    bool                left_button_down;
+    bool                right_button_down;
+
+    u32                 global_scale;
+
+    /* Text */
+    font_t              *font;
+
+    /* FLAGS */
+    bool                running;
+    bool                resize;
+    bool                rescale;
+    bool                render;
+    bool                dock;
+    bool                capture;
+    bool                profile;
+    bool                changed;
+    bool                camera_mode;
+
+    /* TIME */
+    u32                 start_time;
+    u64                 last_render_time;
+    f64                 dt;
+    u64                 render_interval;
+    #ifdef _WIN32
+        LARGE_INTEGER   last_frame_start;
+    #else
+        struct timespec last_frame_start;
+    #endif
+    f64                 frame_history[FRAME_HISTORY_SIZE];
+    i32                 frame_idx;
+    f64                 average_frame_time;
+    f64                 current_fps;
+
+    arena_t             *frame_arena;
+
+    thread_pool_t       *thread_pool;
+};
+
+extern struct context_t gc;
+
+/* Scene */
+scene_objects_t* scene_array_create(size_t initial_capacity);
+i32 scene_array_resize(scene_objects_t* array, size_t new_capacity);
+i32 scene_array_add(scene_objects_t* array, scene_object_t object);
+i32 scene_array_remove(scene_objects_t* array, size_t index);
+void scene_array_destroy(scene_objects_t **array);
+i32 scene_array_add_material(scene_objects_t* array, material_t material);
+i32 scene_array_build_bvh(scene_objects_t *array);
+void init_scene(enum scene_id id);
+
+/* Camera */
+void init_camera(int window_width, f32 aspect_ratio);
+void update_camera_view();
+void increase_fov();
+void decrease_fov();
+void set_fov(f32 new_fov);
+void adjust_fov(f32 delta);
+
+/* Tracing */
+bool hit_closest(scene_objects_t *arr, ray_t *ray, f32 ray_tmin, f32 ray_tmax, f32 *hit_dist, u32 *hit_prim);
+bool hit(scene_objects_t *arr, ray_t *ray, f32 ray_tmin, f32 ray_tmax, hit_record_t *hit_info);
+bool occluded(scene_objects_t *arr, ray_t *ray, f32 ray_tmin, f32 ray_tmax);
+void sphere_surface(scene_objects_t *arr, u32 prim, ray_t *ray, f32 root, hit_record_t *hit_info);
+ray_t get_ray(int x, int y);
+bool roulette_survives(vec3f_t *throughput, i32 depth);
+vec3f_t ray_color(ray_t ray, int depth);
+
+/*
+    Rendering a frame into gc.draw_buffer is split in two so the caller can do
+    other work while the tiles are being traced:
+
+        render_frame_begin();   // allocates the frame and hands the tiles to gc.thread_pool
+        ...
+        render_frame_end();     // waits for the workers and updates the accumulation state
+
+    Another thread can abandon the frame by setting gc.frame_cancel, the samples already
+    taken are kept but the image is incomplete and render_frame_end() returns false.
+*/
+void render_frame_begin(void);
+bool render_frame_end(void);
+void reset_accumulation(void);
+void render_stats_add(render_stats_t *total, render_stats_t *stats);
+void render_tile(void *data);
+void render_tile_wavefront(void *data);
+void trace_tile(void *data);
+
+#endif
@@ -90,7 +90,7 @@
 
 #define FRAND_MAX                 32767  
 
-#define RAND_FLOAT()              (f32)fast_rand() / ((f32)FRAND_MAX + 1.0f)
+#define RAND_FLOAT()              rng_f32(&g_rng)
 #define RAND_FLOAT_RANGE(min,max) (min + (max-min) * (RAND_FLOAT()))
 
 /*
@@ -179,19 +179,49 @@ typedef double      f64;
 #define local_persist       static
 #define global_variable     static
 
+#ifdef _MSC_VER
+    #define THREAD_LOCAL    __declspec(thread)
+#else
+    #define THREAD_LOCAL    _Thread_local
+#endif
+
 #ifdef _WIN32
     typedef HANDLE thread_handle_t;
     typedef DWORD (WINAPI *thread_func_t)(LPVOID);
     typedef LPVOID thread_func_param_t;
     typedef DWORD WINAPI thread_func_ret_t;
+    typedef CRITICAL_SECTION mutex_t;
+    typedef CONDITION_VARIABLE cond_var_t;
+    #define ATOMIC_FETCH_ADD_U32(ptr, v)    (u32)InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(v))
+    #define ATOMIC_LOAD_U32(ptr)            (u32)InterlockedOr((volatile LONG *)(ptr), 0)
+    #define ATOMIC_STORE_U32(ptr, v)        (void)InterlockedExchange((volatile LONG *)(ptr), (LONG)(v))
 #else
     #include <pthread.h>
+    #include <unistd.h>
     typedef pthread_t thread_handle_t;
     typedef void* (*thread_func_t)(void*);
     typedef void* thread_func_param_t;
     typedef void* thread_func_ret_t;
+    typedef pthread_mutex_t mutex_t;
+    typedef pthread_cond_t cond_var_t;
+    #define ATOMIC_FETCH_ADD_U32(ptr, v)    (u32)__atomic_fetch_add((ptr), (v), __ATOMIC_RELAXED)
+    #define ATOMIC_LOAD_U32(ptr)            (u32)__atomic_load_n((ptr), __ATOMIC_RELAXED)
+    #define ATOMIC_STORE_U32(ptr, v)        __atomic_store_n((ptr), (v), __ATOMIC_RELAXED)
 #endif
 
+// unit of work executed by a thread_pool_t worker
+typedef void (*task_func_t)(void *data);
+
+typedef struct thread_pool_t thread_pool_t;
+
+// per worker timings of the last dispatch, used to check load balance
+typedef struct thread_pool_stats_t
+{
+    f64 busy_ms;        // time spent inside tasks
+    f64 idle_ms;        // time spent waiting while other workers were still busy
+    u32 tasks_run;
+}thread_pool_stats_t;
+
 global_variable u32 sign32     = 0x80000000;
 global_variable u32 exponent32 = 0x7F800000;
 global_variable u32 mantissa32 = 0x007FFFFF;
@@ -273,9 +303,91 @@ typedef struct rect_t
 void  log_error(int error_code, const char* file, int line);
 void *check_ptr (void *ptr, const char* file, int line);
 void swap(int* a, int* b);
-void fast_srand(int seed);
+void fast_srand(u32 seed);
 int fast_rand(void);
 
+/*
+    Counter based RNG, every number is a hash of (key, bounce, counter) instead of the next
+    step of a sequence, so a sample draws the same numbers whichever thread renders it
+    and in whatever order.
+
+    The key comes from the pixel, the sample index and a seed, every bounce
+    hashes it into its own stream and draws walk that stream with a Weyl counter:
+
+        rng_seed(&rng, pixel, sample, seed);    // camera ray dimensions
+        rng_set_bounce(&rng, 1);                // first scatter
+        f32 u = rng_f32(&rng);
+*/
+typedef struct rng_t
+{
+    u32 key;
+    u32 state;      // stream of the current bounce + counter * RNG_WEYL
+}rng_t;
+
+#define RNG_WEYL    0x9E3779B9u
+
+// the RNG behind RAND_FLOAT(), seeded by the renderer for every sample
+extern THREAD_LOCAL rng_t g_rng;
+
+// lowbias32 integer hash (Wellons), full avalanche for two multiplies
+static inline u32 rng_hash(u32 x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline void rng_seed(rng_t *rng, u32 pixel, u32 sample, u32 seed)
+{
+    rng->key   = rng_hash(pixel ^ rng_hash(sample ^ rng_hash(seed)));
+    rng->state = rng->key;
+}
+
+static inline void rng_set_bounce(rng_t *rng, u32 bounce)
+{
+    rng->state = rng_hash(rng->key + bounce * RNG_WEYL);
+}
+
+static inline u32 rng_u32(rng_t *rng)
+{
+    rng->state += RNG_WEYL;
+    return rng_hash(rng->state);
+}
+
+// uniform in [0,1), 24 bits so every value is exact in a float
+static inline f32 rng_f32(rng_t *rng)
+{
+    return (f32)(rng_u32(rng) >> 8) * 0x1p-24f;
+}
+
+/*
+    Same numbers as 8 consecutive rng_f32() calls
+*/
+static inline void rng_f32x8(rng_t *rng, f32 *out)
+{
+#ifdef __AVX2__
+    __m256i x = _mm256_add_epi32(_mm256_set1_epi32((i32)rng->state),
+                                 _mm256_mullo_epi32(_mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8), _mm256_set1_epi32((i32)RNG_WEYL)));
+
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((i32)0x846ca68bu));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+
+    __m256 f = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8));
+    _mm256_storeu_ps(out, _mm256_mul_ps(f, _mm256_set1_ps(0x1p-24f)));
+    rng->state += 8 * RNG_WEYL;
+#else
+    for (int i = 0; i < 8; i++) {
+        out[i] = rng_f32(rng);
+    }
+#endif
+}
+
 
 vec2f_t vec2f(float x, float y);
 vec2f_t vec2f_add(vec2f_t a, vec2f_t b);
@@ -301,6 +413,21 @@ bool vec3f_is_near_zero(vec3f_t vec);
 vec3f_t vec3f_reflect(vec3f_t v, vec3f_t n);
 vec3f_t vec3f_refract(vec3f_t v, vec3f_t n, float e);
 
+/*
+    Closed form warps of two uniform numbers in [0,1), no rejection loops so the
+    cost is the same for every sample. The _x8 versions do 8 samples at once with
+    the same math, inputs and outputs are arrays of 8 (SoA).
+*/
+vec3f_t sample_concentric_disk(f32 u1, f32 u2);                         // unit disk in xy, z = 0
+vec3f_t sample_uniform_sphere(f32 u1, f32 u2);
+vec3f_t sample_cosine_hemisphere(vec3f_t normal, f32 u1, f32 u2);       // normal must be unit length
+vec3f_t sample_uniform_cone(vec3f_t axis, f32 cap_height, f32 u1, f32 u2); // cap_height = 1 - cos(theta_max)
+
+void sample_concentric_disk_x8(f32 const *u1, f32 const *u2, f32 *x, f32 *y);
+void sample_uniform_sphere_x8(f32 const *u1, f32 const *u2, f32 *x, f32 *y, f32 *z);
+void sample_cosine_hemisphere_x8(f32 const *nx, f32 const *ny, f32 const *nz,
+                                 f32 const *u1, f32 const *u2, f32 *x, f32 *y, f32 *z);
+
 mat4x4_t mat4x4_mult(mat4x4_t const *m, mat4x4_t const *n);
 mat4x4_t mat4x4_mult_simd(mat4x4_t const *m, mat4x4_t const *n);
 mat4x4_t mat_perspective(f32 n, f32 f, f32 fovY, f32 aspect_ratio);
@@ -314,9 +441,41 @@ mat4x4_t mat_rotate_zx(f32 angle);
 
 f64 get_time_difference(void *last_time);
 void get_time(void *time);
+u64 get_time_ns(void);
 
 thread_handle_t create_thread(thread_func_t func, thread_func_param_t data);
 void join_thread(thread_handle_t thread);
+
+void mutex_init(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+void mutex_destroy(mutex_t *mutex);
+void cond_var_init(cond_var_t *cond);
+void cond_var_wait(cond_var_t *cond, mutex_t *mutex);
+void cond_var_signal(cond_var_t *cond);
+void cond_var_broadcast(cond_var_t *cond);
+void cond_var_destroy(cond_var_t *cond);
+
+/*
+    Persistent workers that sleep on a condition variable until work is dispatched,
+    so the cost of spawning threads is paid once instead of every frame.
+
+    thread_pool_dispatch() hands the pool an array of items, each worker claims
+    the next unprocessed item with an atomic increment so no worker sits idle
+    while there is still work left, no matter how uneven the items are.
+ */
+thread_pool_t *thread_pool_create(u32 thread_count);
+void thread_pool_dispatch(thread_pool_t *pool, task_func_t func, void *items, u32 item_count, size_t item_stride);
+void thread_pool_wait(thread_pool_t *pool);
+u32  thread_pool_thread_count(thread_pool_t *pool);
+void thread_pool_get_stats(thread_pool_t *pool, u32 worker, thread_pool_stats_t *stats);
+void thread_pool_destroy(thread_pool_t **pool);
+
+/*
+    Memory private to the worker running the calling task, allocated on first use
+    and freed by thread_pool_destroy(). Every call has to ask for the same size.
+*/
+void *thread_pool_scratch(size_t size);
 int get_core_count(void);
 
 #define LOG_ERROR(error_code)   log_error(error_code, __FILE__, __LINE__)
@@ -8,13 +8,14 @@ call "C:\Program Files\Microsoft Visual Studio\2022\Community\VC\Auxiliary\Build
 
 set CFLAGS=/Zi /EHsc /D_AMD64_ /fp:fast /W4 /MD /nologo /utf-8 /std:clatest /arch:AVX
 set L_FLAGS=/SUBSYSTEM:CONSOLE
-set SRC=..\Main.c ..\src\util.c ..\src\arena.c ..\src\base_graphics.c ..\external\src\glad.c
+set CORE_SRC=..\src\tracer.c ..\src\headless.c ..\src\util.c ..\src\sampler.c ..\src\prof.c ..\src\arena.c ..\src\base_graphics.c
+set SRC=..\Main.c %CORE_SRC% ..\external\src\glad.c
 set INCLUDE_DIRS=/I..\include /I..\external\include\
 set LIBRARY_DIRS=/LIBPATH:..\external\lib\
 set LIBRARIES=opengl32.lib glfw3.lib glew32.lib UxTheme.lib Dwmapi.lib user32.lib gdi32.lib shell32.lib kernel32.lib
 
 if "%1"=="" (
-    echo Usage: run.bat [rel|dbg]
+    echo Usage: run.bat [rel^|dbg^|headless^|bench]
     exit /b 1
 )
 
@@ -48,5 +49,34 @@ if "%1"=="dbg" (
     exit /b 0
 )
 
+if "%1"=="headless" (
+    echo Building the headless renderer...
+    pushd .\build
+    cl %CFLAGS% /O2 %INCLUDE_DIRS% ..\Headless.c %CORE_SRC% /link UxTheme.lib Dwmapi.lib user32.lib %L_FLAGS%
+    if %errorlevel% neq 0 (
+        echo Build failed!
+        popd
+        exit /b 1
+    )
+    echo Build successful.
+    popd
+    exit /b 0
+)
+
+if "%1"=="bench" (
+    echo Building the benchmark...
+    pushd .\build
+    cl %CFLAGS% /O2 %INCLUDE_DIRS% ..\Bench.c %CORE_SRC% /link UxTheme.lib Dwmapi.lib user32.lib %L_FLAGS%
+    if %errorlevel% neq 0 (
+        echo Build failed!
+        popd
+        exit /b 1
+    )
+    echo Build successful. Running...
+    .\Bench.exe --output bench.json
+    popd
+    exit /b 0
+)
+
 echo Unknown command: %1
 exit /b 1
\ No newline at end of file
@@ -0,0 +1,210 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../external/include/stb_image_write.h"
+
+#include "../include/tracer.h"
+#include "../include/prof.h"
+
+/*
+    Batch rendering without a window or a GL context, for machines that have neither.
+    The scene is rendered once through the same tile renderer the viewer uses
+    and written to disk, the output format is picked from the extension (.png or .tga).
+*/
+
+typedef struct headless_options_t
+{
+    u32         width;
+    u32         height;
+    i32         spp;
+    i32         max_depth;
+    u32         threads;
+    bool        wavefront;
+    bool        no_light_sampling;
+    bool        no_roulette;
+    i32         roulette_min_depth;
+    i32         scene;
+    i32         sampler;
+    const char *output;
+    const char *trace;
+}headless_options_t;
+
+static void headless_usage(const char *exe)
+{
+    fprintf(stderr,
+            "Usage: %s --headless [options]\n"
+            "  --width N        image width             (default 1100)\n"
+            "  --height N       image height            (default width * 9/16)\n"
+            "  --spp N          samples per pixel       (default 10)\n"
+            "  --depth N        max bounces per path    (default 20)\n"
+            "  --threads N      worker threads          (default all cores)\n"
+            "  --wavefront      use the wavefront tile renderer\n"
+            "  --no-light-sampling  find lights by bouncing into them only\n"
+            "  --roulette N     bounces before russian roulette starts (default 3)\n"
+            "  --no-roulette    trace every path to --depth or until it escapes\n"
+            "  --scene NAME     spheres, random_field, glass or lights (default spheres)\n"
+            "  --sampler NAME   random, stratified, sobol or blue_noise (default sobol)\n"
+            "  --output PATH    .png or .tga            (default render.png)\n"
+            "  --trace PATH     write a Chrome trace of the frame, open it in ui.perfetto.dev\n",
+            exe);
+}
+
+static bool headless_parse(int argc, char **argv, headless_options_t *opts)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg   = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--headless") == 0) {
+            continue;
+        } else if (strcmp(arg, "--wavefront") == 0) {
+            opts->wavefront = true;
+            continue;
+        } else if (strcmp(arg, "--no-light-sampling") == 0) {
+            opts->no_light_sampling = true;
+            continue;
+        } else if (strcmp(arg, "--no-roulette") == 0) {
+            opts->no_roulette = true;
+            continue;
+        }
+
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+
+        if      (strcmp(arg, "--width")   == 0) opts->width     = (u32)atoi(value);
+        else if (strcmp(arg, "--height")  == 0) opts->height    = (u32)atoi(value);
+        else if (strcmp(arg, "--spp")     == 0) opts->spp       = atoi(value);
+        else if (strcmp(arg, "--depth")   == 0) opts->max_depth = atoi(value);
+        else if (strcmp(arg, "--threads") == 0) opts->threads   = (u32)atoi(value);
+        else if (strcmp(arg, "--roulette")== 0) opts->roulette_min_depth = atoi(value);
+        else if (strcmp(arg, "--output")  == 0) opts->output    = value;
+        else if (strcmp(arg, "--trace")   == 0) opts->trace     = value;
+        else if (strcmp(arg, "--scene")   == 0) {
+            opts->scene = -1;
+            for (i32 s = 0; s < SceneCount; s++) {
+                if (strcmp(value, scene_names[s]) == 0) opts->scene = s;
+            }
+        }
+        else if (strcmp(arg, "--sampler") == 0) {
+            opts->sampler = -1;
+            for (i32 s = 0; s < SamplerTypeCount; s++) {
+                if (strcmp(value, sampler_names[s]) == 0) opts->sampler = s;
+            }
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return false;
+        }
+        i++;
+    }
+
+    if (opts->height == 0) {
+        opts->height = opts->width * 9 / 16;
+    }
+
+    return opts->width > 1 && opts->height > 1 && opts->spp > 0 && opts->max_depth > 0 && opts->threads > 0 && opts->roulette_min_depth >= 0 && opts->scene >= 0 && opts->sampler >= 0;
+}
+
+static bool headless_write(image_view_t *image, const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    if (ext && strcmp(ext, ".tga") == 0) {
+        export_image(image, path);
+        return true;
+    }
+
+    return stbi_write_png(path, (int)image->width, (int)image->height, 4,
+                          image->pixels, (int)(image->width * sizeof(color4_t))) != 0;
+}
+
+int headless_main(int argc, char **argv)
+{
+    headless_options_t opts = {
+        .width     = 1100,
+        .spp       = 10,
+        .max_depth = 20,
+        .threads   = (u32)get_core_count(),
+        .sampler   = SamplerSobol,
+        .roulette_min_depth = 3,
+        .output    = "render.png",
+    };
+
+    if (!headless_parse(argc, argv, &opts)) {
+        headless_usage(argv[0]);
+        return 1;
+    }
+
+    u64 start_ns = get_time_ns();
+
+    init_camera((int)opts.width, (f32)opts.width / (f32)opts.height);
+    gc.screen_height = opts.height;
+    update_camera_view();
+
+    // one frame takes the whole budget, adaptive sampling has nothing to redistribute
+    gc.samples_per_pixel = opts.spp;
+    gc.samples_per_frame = opts.spp;
+    gc.max_depth         = opts.max_depth;
+    gc.adaptive_error    = 0.0f;
+    gc.wavefront         = opts.wavefront;
+    gc.sampler           = (enum sampler_type)opts.sampler;
+    gc.light_sampling    = !opts.no_light_sampling;
+    gc.russian_roulette  = !opts.no_roulette;
+    gc.roulette_min_depth = opts.roulette_min_depth;
+
+    init_scene((enum scene_id)opts.scene);
+
+    gc.frame_arena = arena_new();
+    gc.thread_pool = CHECK_PTR(thread_pool_create(opts.threads));
+
+    u64 build_ns = get_time_ns();
+    scene_array_build_bvh(gc.scene_objects);
+
+    if (opts.trace) {
+        prof_init();
+        prof_trace_start(opts.trace, 1);
+    }
+
+    u64 render_ns = get_time_ns();
+    render_frame_begin();
+    render_frame_end();
+
+    u64 write_ns = get_time_ns();
+    bool written = headless_write(&gc.draw_buffer, opts.output);
+    u64 end_ns = get_time_ns();
+
+    // after the timings, writing the trace takes a while
+    prof_trace_frame();
+
+    if (!written) {
+        fprintf(stderr, "Failed to write %s\n", opts.output);
+    }
+
+    f64 render_s = (f64)(write_ns - render_ns) * 1e-9;
+
+    printf("%s, %ux%u, %d spp, depth %d, %s sampler, %u threads%s\n", scene_names[opts.scene], opts.width, opts.height, opts.spp, opts.max_depth,
+           sampler_names[gc.sampler], thread_pool_thread_count(gc.thread_pool), gc.wavefront ? ", wavefront" : "");
+    printf("  setup    %10.3f ms\n", (f64)(build_ns  - start_ns)  * 1e-6);
+    printf("  bvh      %10.3f ms\n", (f64)(render_ns - build_ns)  * 1e-6);
+    render_stats_t *stats = &gc.frame_stats;
+    u64 rays = stats->primary_rays + stats->secondary_rays;
+
+    printf("  render   %10.3f ms  (%.2f Mrays/s, %.2f Msamples/s)\n", render_s * 1e3,
+           (f64)rays / render_s * 1e-6, (f64)stats->primary_rays / render_s * 1e-6);
+    printf("  rays     %10llu primary, %llu secondary, %.1f%% of the paths escaped\n",
+           (unsigned long long)stats->primary_rays, (unsigned long long)stats->secondary_rays,
+           100.0 * (f64)stats->escaped / (f64)MAX(stats->primary_rays, 1));
+    printf("  paths    %10.2f bounces/sample, %u max, %llu ended by roulette\n",
+           (f64)stats->bounces / (f64)MAX(stats->primary_rays, 1), stats->max_path_depth,
+           (unsigned long long)stats->roulette_kills);
+    printf("  tests    %10.2f BVH nodes/ray, %.2f spheres/ray\n",
+           (f64)stats->bvh_nodes / (f64)MAX(rays, 1), (f64)stats->sphere_tests / (f64)MAX(rays, 1));
+    printf("  write    %10.3f ms  -> %s\n", (f64)(end_ns - write_ns) * 1e-6, opts.output);
+    printf("  total    %10.3f ms\n", (f64)(end_ns - start_ns) * 1e-6);
+
+    thread_pool_destroy(&gc.thread_pool);
+    arena_delete(&gc.frame_arena);
+
+    return written ? 0 : 1;
+}
@@ -0,0 +1,2 @@
+#define PROF_IMPLEMENTATION
+#include "prof.h"
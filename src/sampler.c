@@ -0,0 +1,244 @@
+#include "../include/sampler.h"
+
+const char *sampler_names[SamplerTypeCount] = {
+    [SamplerRandom]     = "random",
+    [SamplerStratified] = "stratified",
+    [SamplerSobol]      = "sobol",
+    [SamplerBlueNoise]  = "blue_noise",
+};
+
+// 0.32 fixed point to a float in [0,1)
+static inline f32 u32_to_unit_f32(u32 x)
+{
+    return (f32)(x >> 8) * 0x1p-24f;
+}
+
+static inline u32 reverse_bits_u32(u32 x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/*
+    Owen scrambling in base 2 flips every bit depending on a hash of the bits above it.
+    Laine-Karras style hashes do that for the bits below instead, so the scramble
+    is run on the reversed value (Burley, Practical Hash-based Owen Scrambling).
+*/
+static inline u32 laine_karras_permutation(u32 x, u32 seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static inline u32 nested_uniform_scramble(u32 x, u32 seed)
+{
+    return reverse_bits_u32(laine_karras_permutation(reverse_bits_u32(x), seed));
+}
+
+/*
+    The first two Sobol dimensions, kept bit reversed so the scramble that follows
+    doesn't have to reverse them again. The first one reversed is the index itself,
+    the second multiplies it by the Pascal matrix mod 2 whose entry (j,k) is set when
+    the bits of j are a subset of the bits of k, a superset xor-sum in 5 steps
+    instead of a loop over the index bits.
+*/
+static inline u32 sobol_dim0_reversed(u32 index)
+{
+    return index;
+}
+
+static inline u32 sobol_dim1_reversed(u32 index)
+{
+    index ^= (index >>  1) & 0x55555555u;
+    index ^= (index >>  2) & 0x33333333u;
+    index ^= (index >>  4) & 0x0F0F0F0Fu;
+    index ^= (index >>  8) & 0x00FF00FFu;
+    index ^= (index >> 16) & 0x0000FFFFu;
+    return index;
+}
+
+static inline u32 owen_scramble_reversed(u32 x, u32 seed)
+{
+    return reverse_bits_u32(laine_karras_permutation(x, seed));
+}
+
+/*
+    Random permutation of [0,len) picked by seed, a bijection so every stratum
+    is visited once every len samples (Kensler, Correlated Multi-Jittered Sampling)
+*/
+static u32 permute(u32 i, u32 len, u32 seed)
+{
+    u32 w = len - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+
+    do {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= len);
+
+    return (i + seed) % len;
+}
+
+/*
+    Stand-in for a precomputed blue noise tile: the R2 ordered dither
+    frac(0.7548776662 x + 0.5698402910 y) (Roberts) has most of its energy in the
+    high frequencies, shifted per dimension so dimensions don't share a mask.
+*/
+static inline u32 blue_noise_mask(u32 x, u32 y, u32 dimension)
+{
+    u32 shift = rng_hash(dimension * RNG_WEYL);
+    x += shift & 0xFF;
+    y += (shift >> 8) & 0xFF;
+    return x * 0xC13FA9A9u + y * 0x91E10DA5u;
+}
+
+/*
+    A bounce takes at most SAMPLER_BOUNCE_DIMS numbers, so the white noise samplers
+    draw them all with one rng_f32x8() when the bounce starts. Anything past the
+    batch keeps walking the same stream, the numbers don't change either way.
+*/
+static inline void sampler_fill_batch(sampler_t *sampler)
+{
+    if (sampler->type == SamplerRandom || sampler->type == SamplerStratified) {
+        rng_f32x8(&sampler->rng, sampler->batch);
+        sampler->batch_next = 0;
+    } else {
+        sampler->batch_next = SAMPLER_BOUNCE_DIMS;
+    }
+}
+
+static inline f32 sampler_next_f32(sampler_t *sampler)
+{
+    if (sampler->batch_next < SAMPLER_BOUNCE_DIMS) {
+        return sampler->batch[sampler->batch_next++];
+    }
+    return rng_f32(&sampler->rng);
+}
+
+void sampler_start(sampler_t *sampler, enum sampler_type type, u32 x, u32 y, u32 pixel, u32 sample, u32 spp, u32 seed)
+{
+    sampler->type      = type;
+    sampler->x         = x;
+    sampler->y         = y;
+    sampler->key       = rng_hash(pixel ^ rng_hash(seed));
+    sampler->seed      = seed;
+    sampler->sample    = sample;
+    sampler->spp       = MAX(spp, 1);
+    sampler->grid      = (u32)ceilf(sqrt_f32((f32)sampler->spp));
+    sampler->dimension = 0;
+
+    rng_seed(&sampler->rng, pixel, sample, seed);
+    sampler_fill_batch(sampler);
+}
+
+void sampler_set_bounce(sampler_t *sampler, u32 bounce)
+{
+    sampler->dimension = (bounce == 0) ? 0 : SAMPLER_CAMERA_DIMS + (bounce - 1) * SAMPLER_BOUNCE_DIMS;
+    rng_set_bounce(&sampler->rng, bounce);
+    sampler_fill_batch(sampler);
+}
+
+f32 sampler_get_1d(sampler_t *sampler)
+{
+    u32 dim = sampler->dimension++;
+
+    switch (sampler->type)
+    {
+        case SamplerStratified:
+        {
+            u32 stratum = permute(sampler->sample % sampler->spp, sampler->spp, rng_hash(sampler->key + dim));
+            return ((f32)stratum + sampler_next_f32(sampler)) / (f32)sampler->spp;
+        }
+        case SamplerSobol:
+        {
+            u32 seed  = rng_hash(sampler->key + dim * RNG_WEYL);
+            u32 index = nested_uniform_scramble(sampler->sample, seed);
+            return u32_to_unit_f32(owen_scramble_reversed(sobol_dim0_reversed(index), rng_hash(seed + 1)));
+        }
+        case SamplerBlueNoise:
+        {
+            // the same shuffled sequence in every pixel, only the mask changes
+            u32 seed  = rng_hash(sampler->seed + dim * RNG_WEYL);
+            u32 index = nested_uniform_scramble(sampler->sample, seed);
+            u32 value = owen_scramble_reversed(sobol_dim0_reversed(index), rng_hash(seed + 1));
+            return u32_to_unit_f32(value + blue_noise_mask(sampler->x, sampler->y, dim));
+        }
+        case SamplerRandom:
+        default:
+            return sampler_next_f32(sampler);
+    }
+}
+
+void sampler_get_2d(sampler_t *sampler, f32 *u1, f32 *u2)
+{
+    u32 dim = sampler->dimension;
+    sampler->dimension += 2;
+
+    switch (sampler->type)
+    {
+        case SamplerStratified:
+        {
+            // closest square grid, samples past n*n start over on a new shuffle
+            u32 n = sampler->grid;
+            u32 cells = n * n;
+            u32 pass  = sampler->sample / cells;
+            u32 cell  = permute(sampler->sample % cells, cells, rng_hash(sampler->key + dim + pass * 0x68bc21ebu));
+
+            *u1 = ((f32)(cell % n) + sampler_next_f32(sampler)) / (f32)n;
+            *u2 = ((f32)(cell / n) + sampler_next_f32(sampler)) / (f32)n;
+            break;
+        }
+        case SamplerSobol:
+        {
+            u32 seed  = rng_hash(sampler->key + dim * RNG_WEYL);
+            u32 index = nested_uniform_scramble(sampler->sample, seed);
+
+            *u1 = u32_to_unit_f32(owen_scramble_reversed(sobol_dim0_reversed(index), rng_hash(seed + 1)));
+            *u2 = u32_to_unit_f32(owen_scramble_reversed(sobol_dim1_reversed(index), rng_hash(seed + 2)));
+            break;
+        }
+        case SamplerBlueNoise:
+        {
+            u32 seed  = rng_hash(sampler->seed + dim * RNG_WEYL);
+            u32 index = nested_uniform_scramble(sampler->sample, seed);
+            u32 v1 = owen_scramble_reversed(sobol_dim0_reversed(index), rng_hash(seed + 1));
+            u32 v2 = owen_scramble_reversed(sobol_dim1_reversed(index), rng_hash(seed + 2));
+
+            *u1 = u32_to_unit_f32(v1 + blue_noise_mask(sampler->x, sampler->y, dim));
+            *u2 = u32_to_unit_f32(v2 + blue_noise_mask(sampler->x, sampler->y, dim + 1));
+            break;
+        }
+        case SamplerRandom:
+        default:
+            *u1 = sampler_next_f32(sampler);
+            *u2 = sampler_next_f32(sampler);
+            break;
+    }
+}
@@ -0,0 +1,2314 @@
+#include "../include/tracer.h"
+#include "../include/prof.h"
+
+struct context_t gc;
+
+scene_objects_t* scene_array_create(size_t initial_capacity)
+{
+    if (initial_capacity == 0) {
+        initial_capacity = 16; // Default initial capacity
+    }
+    
+    scene_objects_t *array = malloc(sizeof(scene_objects_t));
+
+    if (!array) {
+        return NULL;
+    }
+    
+    array->objects = malloc(sizeof(scene_object_t) * initial_capacity);
+
+    if (!array->objects) {
+        free(array);
+        return NULL;
+    }
+    
+    array->count = 0;
+    array->capacity = initial_capacity;
+
+    array->materials = (material_table_t){0};
+    array->lights = NULL;
+    array->light_count = 0;
+    array->light_capacity = 0;
+    array->sky_intensity = 1.0f;
+    array->bvh = (bvh_t){0};
+    array->spheres = (sphere_soa_t){0};
+    array->bvh_dirty = true;
+    
+    return array;
+}
+
+i32 scene_array_resize(scene_objects_t* array, size_t new_capacity)
+{
+    if (!array || new_capacity < array->count) {
+        return -1; 
+    }
+    
+    scene_object_t *new_objects = realloc(array->objects, sizeof(scene_object_t) * new_capacity);
+    if (!new_objects) {
+        return -1; // Memory allocation failed
+    }
+    
+    array->objects = new_objects;
+    array->capacity = new_capacity;
+    
+    return 0; // Success
+}
+
+i32 scene_array_add(scene_objects_t* array, scene_object_t object)
+{
+    if (!array) {
+        return -1;
+    }
+    
+    if (array->count >= array->capacity) 
+    {
+        size_t new_capacity = array->capacity * 2;
+        if (scene_array_resize(array, new_capacity) != 0) {
+            return -1; // Resize failed
+        }
+    }
+    
+    array->objects[array->count] = object;
+    array->count++;
+    array->bvh_dirty = true;
+    
+    return 0; 
+}
+
+/*
+    Returns the id objects refer to the material by, -1 if it could not be stored
+*/
+i32 scene_array_add_material(scene_objects_t* array, material_t material)
+{
+    if (!array) {
+        return -1;
+    }
+
+    material_table_t *table = &array->materials;
+
+    if (table->count >= table->capacity)
+    {
+        u32 new_capacity = table->capacity ? table->capacity * 2 : 16;
+        material_t *new_items = realloc(table->items, sizeof(material_t) * new_capacity);
+        if (!new_items) {
+            return -1;
+        }
+        table->items = new_items;
+        table->capacity = new_capacity;
+    }
+
+    table->items[table->count] = material;
+
+    return (i32)table->count++;
+}
+
+void scene_array_destroy(scene_objects_t **array)
+{
+    if (!array || !*array) {
+        return;
+    }
+
+    scene_objects_t *arr = *array;
+
+    _mm_free(arr->spheres.center_x);
+    _mm_free(arr->spheres.center_y);
+    _mm_free(arr->spheres.center_z);
+    _mm_free(arr->spheres.radius);
+    _mm_free(arr->spheres.object);
+    _mm_free(arr->spheres.material);
+    free(arr->materials.items);
+    free(arr->lights);
+    free(arr->bvh.nodes);
+    free(arr->bvh.indices);
+    free(arr->objects);
+    free(arr);
+
+    *array = NULL;
+}
+
+i32 scene_array_remove(scene_objects_t* array, size_t index)
+{
+    if (!array || index >= array->count) {
+        return -1; // Invalid parameters
+    }
+    
+    // Shift elements to fill the gap
+    for (size_t i = index; i < array->count - 1; i++) {
+        array->objects[i] = array->objects[i + 1];
+    }
+    
+    array->count--;
+    array->bvh_dirty = true;
+    
+    if (array->count > 0 && array->count < array->capacity / 4) {
+        scene_array_resize(array, array->capacity / 2);
+    }
+    
+    return 0; // Success
+}
+
+aabb_t aabb_empty(void)
+{
+    return (aabb_t){
+        .min = { max_f32,  max_f32,  max_f32},
+        .max = {-max_f32, -max_f32, -max_f32}
+    };
+}
+
+aabb_t aabb_union(aabb_t a, aabb_t b)
+{
+    return (aabb_t){
+        .min = {MIN(a.min.x, b.min.x), MIN(a.min.y, b.min.y), MIN(a.min.z, b.min.z)},
+        .max = {MAX(a.max.x, b.max.x), MAX(a.max.y, b.max.y), MAX(a.max.z, b.max.z)}
+    };
+}
+
+aabb_t aabb_grow(aabb_t a, vec3f_t p)
+{
+    return (aabb_t){
+        .min = {MIN(a.min.x, p.x), MIN(a.min.y, p.y), MIN(a.min.z, p.z)},
+        .max = {MAX(a.max.x, p.x), MAX(a.max.y, p.y), MAX(a.max.z, p.z)}
+    };
+}
+
+f32 aabb_area(aabb_t a)
+{
+    vec3f_t e = vec3f_sub(a.max, a.min);
+    if(e.x < 0.0f || e.y < 0.0f || e.z < 0.0f){
+        return 0.0f;    // empty box
+    }
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+f32 vec3f_axis(vec3f_t v, i32 axis)
+{
+    return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+}
+
+aabb_t scene_object_bounds(scene_object_t *obj)
+{
+    switch (obj->type)
+    {
+        case Sphere:
+            sphere_t *sphere = (sphere_t *)obj->object;
+            // padded a little, hit_spheres() can return roots a few ulps outside
+            // the true surface which is noticeable on the 1000 unit ground sphere
+            f32 radius = sphere->radius * (1.0f + 1e-4f);
+            vec3f_t r = {radius, radius, radius};
+            return (aabb_t){vec3f_sub(sphere->center, r), vec3f_add(sphere->center, r)};
+
+        default:
+            break;
+    }
+    return aabb_empty();
+}
+
+/*
+    Binned surface area heuristic:
+
+    The probability that a ray hitting the parent box also hits a child box is
+    roughly area(child)/area(parent), so the expected cost of a split is
+
+        C = C_trav + (A_left * N_left + A_right * N_right) / A_parent * C_isect
+
+    Instead of sorting the primitives along each axis we drop their centroids into
+    BVH_BINS buckets and only evaluate the BVH_BINS-1 planes between them,
+    which keeps the build O(n log n) and fast enough for 100k+ objects.
+*/
+typedef struct bvh_bin_t
+{
+    aabb_t bounds;
+    u32    count;
+}bvh_bin_t;
+
+void bvh_update_bounds(bvh_t *bvh, u32 node_idx, aabb_t *prim_bounds)
+{
+    bvh_node_t *node = &bvh->nodes[node_idx];
+    node->bounds = aabb_empty();
+
+    for(u32 i = 0; i < node->count; i++)
+    {
+        node->bounds = aabb_union(node->bounds, prim_bounds[bvh->indices[node->left_first + i]]);
+    }
+}
+
+void bvh_subdivide(bvh_t *bvh, u32 node_idx, aabb_t *prim_bounds, vec3f_t *centroids, u32 depth)
+{
+    bvh_node_t *node = &bvh->nodes[node_idx];
+
+    if(node->count <= 1 || depth >= BVH_MAX_DEPTH - 1){
+        return;
+    }
+
+    aabb_t centroid_bounds = aabb_empty();
+    for(u32 i = 0; i < node->count; i++)
+    {
+        centroid_bounds = aabb_grow(centroid_bounds, centroids[bvh->indices[node->left_first + i]]);
+    }
+
+    f32 best_cost  = max_f32;
+    i32 best_axis  = -1;
+    u32 best_split = 0;
+
+    for(i32 axis = 0; axis < 3; axis++)
+    {
+        f32 bounds_min = vec3f_axis(centroid_bounds.min, axis);
+        f32 bounds_max = vec3f_axis(centroid_bounds.max, axis);
+
+        if(bounds_min == bounds_max){
+            continue;   // all centroids on the same plane, nothing to split
+        }
+
+        bvh_bin_t bins[BVH_BINS];
+        for(u32 b = 0; b < BVH_BINS; b++){
+            bins[b] = (bvh_bin_t){aabb_empty(), 0};
+        }
+
+        f32 scale = (f32)BVH_BINS / (bounds_max - bounds_min);
+
+        for(u32 i = 0; i < node->count; i++)
+        {
+            u32 prim = bvh->indices[node->left_first + i];
+            u32 b = MIN(BVH_BINS - 1, (u32)((vec3f_axis(centroids[prim], axis) - bounds_min) * scale));
+            bins[b].count++;
+            bins[b].bounds = aabb_union(bins[b].bounds, prim_bounds[prim]);
+        }
+
+        // sweep from both sides to get the area and count of every split plane
+        f32 left_area[BVH_BINS - 1],  right_area[BVH_BINS - 1];
+        u32 left_count[BVH_BINS - 1], right_count[BVH_BINS - 1];
+
+        aabb_t left_box  = aabb_empty();
+        aabb_t right_box = aabb_empty();
+        u32 left_sum = 0, right_sum = 0;
+
+        for(u32 b = 0; b < BVH_BINS - 1; b++)
+        {
+            left_sum += bins[b].count;
+            left_box  = aabb_union(left_box, bins[b].bounds);
+            left_count[b] = left_sum;
+            left_area[b]  = aabb_area(left_box);
+
+            right_sum += bins[BVH_BINS - 1 - b].count;
+            right_box  = aabb_union(right_box, bins[BVH_BINS - 1 - b].bounds);
+            right_count[BVH_BINS - 2 - b] = right_sum;
+            right_area[BVH_BINS - 2 - b]  = aabb_area(right_box);
+        }
+
+        for(u32 b = 0; b < BVH_BINS - 1; b++)
+        {
+            if(left_count[b] == 0 || right_count[b] == 0){
+                continue;
+            }
+
+            f32 cost = left_count[b] * left_area[b] + right_count[b] * right_area[b];
+            if(cost < best_cost)
+            {
+                best_cost  = cost;
+                best_axis  = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    if(best_axis < 0){
+        return;
+    }
+
+    f32 parent_area = aabb_area(node->bounds);
+    f32 split_cost  = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * best_cost / parent_area / SPHERE_LANES;
+    f32 leaf_cost   = BVH_INTERSECT_COST * CEIL_DIV(node->count, SPHERE_LANES);  // one test per group of lanes
+
+    if(parent_area > 0.0f && split_cost >= leaf_cost && node->count <= BVH_MAX_LEAF_SIZE){
+        return;
+    }
+
+    // partition the index range in place around the chosen plane
+    f32 bounds_min = vec3f_axis(centroid_bounds.min, best_axis);
+    f32 scale = (f32)BVH_BINS / (vec3f_axis(centroid_bounds.max, best_axis) - bounds_min);
+
+    u32 i = node->left_first;
+    u32 j = node->left_first + node->count;
+
+    while(i < j)
+    {
+        u32 b = MIN(BVH_BINS - 1, (u32)((vec3f_axis(centroids[bvh->indices[i]], best_axis) - bounds_min) * scale));
+        if(b <= best_split){
+            i++;
+        }else{
+            j--;
+            SWAP(bvh->indices[i], bvh->indices[j], u32);
+        }
+    }
+
+    u32 left_count = i - node->left_first;
+    if(left_count == 0 || left_count == node->count){
+        return;
+    }
+
+    u32 left_idx  = bvh->node_count++;
+    u32 right_idx = bvh->node_count++;
+
+    bvh->nodes[left_idx]  = (bvh_node_t){.left_first = node->left_first, .count = left_count};
+    bvh->nodes[right_idx] = (bvh_node_t){.left_first = i, .count = node->count - left_count};
+
+    node->left_first = left_idx;
+    node->count = 0;
+
+    bvh_update_bounds(bvh, left_idx, prim_bounds);
+    bvh_update_bounds(bvh, right_idx, prim_bounds);
+
+    bvh_subdivide(bvh, left_idx, prim_bounds, centroids, depth + 1);
+    bvh_subdivide(bvh, right_idx, prim_bounds, centroids, depth + 1);
+}
+
+i32 sphere_soa_reserve(sphere_soa_t *soa, u32 count)
+{
+    u32 capacity = ALIGN_UP(count + SPHERE_LANES - 1, SPHERE_LANES);
+
+    if (capacity <= soa->capacity) {
+        return 0;
+    }
+
+    _mm_free(soa->center_x);
+    _mm_free(soa->center_y);
+    _mm_free(soa->center_z);
+    _mm_free(soa->radius);
+    _mm_free(soa->object);
+    _mm_free(soa->material);
+
+    soa->center_x = _mm_malloc(sizeof(f32) * capacity, 32);
+    soa->center_y = _mm_malloc(sizeof(f32) * capacity, 32);
+    soa->center_z = _mm_malloc(sizeof(f32) * capacity, 32);
+    soa->radius   = _mm_malloc(sizeof(f32) * capacity, 32);
+    soa->object   = _mm_malloc(sizeof(u32) * capacity, 32);
+    soa->material = _mm_malloc(sizeof(u32) * capacity, 32);
+
+    if (!soa->center_x || !soa->center_y || !soa->center_z || !soa->radius || !soa->object || !soa->material) {
+        soa->capacity = 0;
+        return -1;
+    }
+
+    soa->capacity = capacity;
+    return 0;
+}
+
+/*
+    Copy the spheres into the soa arrays in the order the bvh leaves reference them
+*/
+i32 scene_array_pack_spheres(scene_objects_t *array)
+{
+    sphere_soa_t *soa = &array->spheres;
+    u32 count = (u32)array->count;
+
+    if (sphere_soa_reserve(soa, count) != 0) {
+        return -1;
+    }
+
+    for (u32 i = 0; i < count; i++)
+    {
+        u32 idx = array->bvh.indices[i];
+        assert(array->objects[idx].type == Sphere);
+
+        sphere_t *sphere = (sphere_t *)array->objects[idx].object;
+        soa->center_x[i] = sphere->center.x;
+        soa->center_y[i] = sphere->center.y;
+        soa->center_z[i] = sphere->center.z;
+        soa->radius[i]   = sphere->radius;
+        soa->object[i]   = idx;
+        soa->material[i] = sphere->mat_id;
+    }
+
+    // padding lanes are masked out but keep them initialized
+    for (u32 i = count; i < soa->capacity; i++)
+    {
+        soa->center_x[i] = soa->center_y[i] = soa->center_z[i] = soa->radius[i] = 0.0f;
+        soa->object[i] = soa->material[i] = 0;
+    }
+
+    soa->count = count;
+
+    return 0;
+}
+
+/*
+    Every sphere with an emissive material goes in the light list
+*/
+i32 scene_array_collect_lights(scene_objects_t *array)
+{
+    array->light_count = 0;
+
+    for (size_t i = 0; i < array->count; i++)
+    {
+        if (array->objects[i].type != Sphere) {
+            continue;
+        }
+
+        sphere_t *sphere = (sphere_t *)array->objects[i].object;
+        if (scene_material(array, sphere->mat_id)->mat_type != Emissive) {
+            continue;
+        }
+
+        if (array->light_count >= array->light_capacity)
+        {
+            u32 new_capacity = array->light_capacity ? array->light_capacity * 2 : 16;
+            light_t *new_lights = realloc(array->lights, sizeof(light_t) * new_capacity);
+            if (!new_lights) {
+                return -1;
+            }
+            array->lights = new_lights;
+            array->light_capacity = new_capacity;
+        }
+
+        array->lights[array->light_count++] = (light_t){sphere->center, sphere->radius, sphere->mat_id};
+    }
+
+    return 0;
+}
+
+i32 scene_array_build_bvh(scene_objects_t *array)
+{
+    if (!array) {
+        return -1;
+    }
+
+    bvh_t *bvh = &array->bvh;
+    u32 count = (u32)array->count;
+
+    if (count > bvh->capacity)
+    {
+        // a binary tree with n leaves never has more than 2n-1 nodes
+        bvh_node_t *new_nodes = realloc(bvh->nodes, sizeof(bvh_node_t) * (2 * count - 1));
+        if (!new_nodes) {
+            return -1;
+        }
+        bvh->nodes = new_nodes;
+
+        u32 *new_indices = realloc(bvh->indices, sizeof(u32) * count);
+        if (!new_indices) {
+            return -1;
+        }
+        bvh->indices = new_indices;
+        bvh->capacity = count;
+    }
+
+    bvh->node_count = 0;
+    array->spheres.count = 0;
+    array->light_count = 0;
+    array->bvh_dirty = false;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    aabb_t  *prim_bounds = malloc(sizeof(aabb_t) * count);
+    vec3f_t *centroids   = malloc(sizeof(vec3f_t) * count);
+
+    if (!prim_bounds || !centroids) {
+        free(prim_bounds);
+        free(centroids);
+        array->bvh_dirty = true;
+        return -1;
+    }
+
+    for (u32 i = 0; i < count; i++)
+    {
+        prim_bounds[i] = scene_object_bounds(&array->objects[i]);
+        centroids[i]   = vec3f_scale(vec3f_add(prim_bounds[i].min, prim_bounds[i].max), 0.5f);
+        bvh->indices[i] = i;
+    }
+
+    bvh->nodes[0] = (bvh_node_t){.left_first = 0, .count = count};
+    bvh->node_count = 1;
+
+    bvh_update_bounds(bvh, 0, prim_bounds);
+    bvh_subdivide(bvh, 0, prim_bounds, centroids, 0);
+
+    free(prim_bounds);
+    free(centroids);
+
+    if (scene_array_pack_spheres(array) != 0 || scene_array_collect_lights(array) != 0) {
+        bvh->node_count = 0;
+        array->bvh_dirty = true;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* 
+    We can determine if the ray is inside or outside the sphere.
+    by doing the dot product of the ray direction and the outward normal.
+    If the dot product is positive, the ray is inside the sphere.
+    If it is negative, the ray is outside the sphere. 
+*/
+void set_face_normal(hit_record_t *record, ray_t *ray, vec3f_t *outward_normal)
+{
+    record->front_face = vec3f_dot(ray->dir, *outward_normal) < 0;
+
+    if(record->front_face)
+    {
+        // ray is outside the sphere
+        record->norm = *outward_normal;
+    }
+    else
+    {
+        // ray is inside the sphere
+        record->norm = vec3f_scale(*outward_normal, -1.0f);
+    }
+}
+
+// Schlick Approximation
+f32 reflectance(f32 cosine, f32 refraction_index)
+{
+    f32 r0 = (1-refraction_index)/(1+refraction_index);
+    r0 = r0*r0;
+    return r0 + (1-r0)*((1-cosine)*(1-cosine)*(1-cosine)*(1-cosine)*(1-cosine));
+}
+
+// samples of the path being traced on this thread, started by the renderers
+static THREAD_LOCAL sampler_t g_sampler;
+
+// work done by this thread in the tile it is running, cleared by the renderers
+static THREAD_LOCAL render_stats_t g_stats;
+
+bool ray_scatter(ray_t *ray_in, hit_record_t *hit_info, vec3f_t *attenuation, ray_t *ray_scattered)
+{
+    material_t *mat = scene_material(gc.scene_objects, hit_info->mat_id);
+
+    switch (mat->mat_type) 
+    {
+        case Lambertian:
+            f32 u1, u2;
+            sampler_get_2d(&g_sampler, &u1, &u2);
+            vec3f_t scatter_dir = sample_cosine_hemisphere(hit_info->norm, u1, u2);
+
+            *ray_scattered = (ray_t){hit_info->hit_point, scatter_dir};
+            *attenuation = mat->albedo;
+
+            return true;
+            
+        case Metal:
+            sampler_get_2d(&g_sampler, &u1, &u2);
+            vec3f_t reflected = vec3f_reflect(ray_in->dir, hit_info->norm);
+            reflected = vec3f_add(vec3f_unit(reflected), vec3f_scale(sample_uniform_sphere(u1, u2), mat->fuzz));
+            *ray_scattered = (ray_t){hit_info->hit_point, reflected};
+            *attenuation = mat->albedo;
+
+            return (vec3f_dot(ray_scattered->dir , hit_info->norm) > 0);
+
+        case Dielectric:
+            *attenuation = (vec3f_t){1.0f,1.0f,1.0f};
+
+            // refraction index ratio based on whether the ray is entering or exiting the material
+            f32 ri = hit_info->front_face ? (1.0f/mat->refraction_index) : mat->refraction_index;
+
+            vec3f_t unit_direction = vec3f_unit(ray_in->dir);
+
+            // angle between incoming ray and the normal
+            f32 cos_theta = (f32)fmin(vec3f_dot(vec3f_scale(unit_direction,-1.0f), hit_info->norm), 1.0f);
+            f32 sin_theta = (f32)sqrt_f32(1.0f-cos_theta*cos_theta);
+
+            bool cannot_refract = ri * sin_theta > 1.0; // Total Internal Reflection
+            vec3f_t direction;
+
+            // Fresnel Reflectance
+            if(cannot_refract || reflectance(cos_theta,ri) > sampler_get_1d(&g_sampler))
+            {
+
+                direction = vec3f_reflect(unit_direction, hit_info->norm);
+            }
+            else
+            {
+                direction = vec3f_refract(unit_direction, hit_info->norm, ri);
+            }
+
+            *ray_scattered = (ray_t){hit_info->hit_point, direction};
+
+            return true;
+
+        case Emissive:
+            break;
+        default:
+            break;
+    }
+
+    return false;
+}
+
+/*
+    Fill the hit record for a sphere once we know the distance to it
+*/
+void sphere_surface(scene_objects_t *arr, u32 prim, ray_t *ray, f32 root, hit_record_t *hit_info)
+{
+    sphere_soa_t *spheres = &arr->spheres;
+    vec3f_t center = {spheres->center_x[prim], spheres->center_y[prim], spheres->center_z[prim]};
+
+    hit_info->hit_dist = root;   // Distance along ray to hit point
+    hit_info->hit_point = RAY_AT(ray, hit_info->hit_dist); // 3D pos of the hit point.
+
+    // calculate the surface normal at the hit point
+    // where normal = (hit_point - sphere_center)
+    // outward_normal have unit length so divide the sphere radius.
+    vec3f_t surface_notmal = vec3f_scale(vec3f_sub(hit_info->hit_point, center), 1.0f/(f32)spheres->radius[prim]);
+
+    set_face_normal(hit_info, ray, &surface_notmal);
+
+    hit_info->mat_id  = spheres->material[prim];
+    hit_info->prim_id = spheres->object[prim];
+}
+
+/*
+    Check if the ray hits any of the spheres [first, first+count),
+    on a closer hit updates closest and hit_prim.
+*/
+bool hit_spheres_scalar(sphere_soa_t *spheres, u32 first, u32 count, ray_t *ray, f32 ray_tmin, f32 *closest, u32 *hit_prim)
+{
+    bool hit_anything = false;
+
+    /*
+        A ray: P(t) = origin + t * direction
+        A sphere: (P - center)² = radius²
+
+        Solution of the quadratic equation of the sphere
+
+         -b +- discriminant
+         ------------------  where discriminant = sqrt(b^2 - 4ac)
+                2*a
+
+        gives us two solutions (where ray enters and exits the sphere)
+
+        t = (-b ± √(b² - 4ac)) / 2a
+        
+        With (h = -b/2):
+        t = (h ± √(h² - ac)) / a
+
+    */
+    f32 a = vec3f_length_sq(ray->dir);
+
+    for(u32 i = first; i < first + count; i++)
+    {
+        // vector from ray origin to the sphere
+        vec3f_t oc = vec3f_sub((vec3f_t){spheres->center_x[i], spheres->center_y[i], spheres->center_z[i]}, ray->orig);
+
+        f32 h = vec3f_dot(ray->dir, oc);
+        f32 c = vec3f_length_sq(oc) - spheres->radius[i] * spheres->radius[i];
+
+        // is there real solutions ?
+        f32 discriminant = h*h - a*c;
+        if(discriminant < 0){
+            // no intersection
+            continue;
+        }
+
+        f32 disc_sqrt = sqrt_f32(discriminant);
+        f32 root = (h - disc_sqrt) / (a); // distance to the CLOSER hit point (entry point)
+
+        if(!Surrounds(root, ray_tmin, *closest))
+        {
+            root = (h + disc_sqrt) / (a);  // check other root (exit point)
+
+            // if both intersection outside the range just skip it
+            if(!Surrounds(root, ray_tmin, *closest))
+            {
+                continue;
+            }
+        }
+
+        *closest  = root;
+        *hit_prim = i;
+        hit_anything = true;
+    }
+
+    return hit_anything;
+}
+
+#ifdef __AVX__
+/*
+    Same as hit_spheres_scalar() but one ray against SPHERE_LANES spheres at a time,
+    lanes past the end of the range are masked out.
+*/
+bool hit_spheres_avx(sphere_soa_t *spheres, u32 first, u32 count, ray_t *ray, f32 ray_tmin, f32 *closest, u32 *hit_prim)
+{
+    bool hit_anything = false;
+
+    __m256 orig_x = _mm256_set1_ps(ray->orig.x);
+    __m256 orig_y = _mm256_set1_ps(ray->orig.y);
+    __m256 orig_z = _mm256_set1_ps(ray->orig.z);
+    __m256 dir_x  = _mm256_set1_ps(ray->dir.x);
+    __m256 dir_y  = _mm256_set1_ps(ray->dir.y);
+    __m256 dir_z  = _mm256_set1_ps(ray->dir.z);
+    __m256 a      = _mm256_set1_ps(vec3f_length_sq(ray->dir));
+    __m256 tmin   = _mm256_set1_ps(ray_tmin);
+    __m256 zero   = _mm256_setzero_ps();
+    __m256 lane   = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    for(u32 i = 0; i < count; i += SPHERE_LANES)
+    {
+        u32 base = first + i;
+
+        __m256 oc_x = _mm256_sub_ps(_mm256_loadu_ps(spheres->center_x + base), orig_x);
+        __m256 oc_y = _mm256_sub_ps(_mm256_loadu_ps(spheres->center_y + base), orig_y);
+        __m256 oc_z = _mm256_sub_ps(_mm256_loadu_ps(spheres->center_z + base), orig_z);
+        __m256 r    = _mm256_loadu_ps(spheres->radius + base);
+
+        __m256 h = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dir_x, oc_x), _mm256_mul_ps(dir_y, oc_y)), _mm256_mul_ps(dir_z, oc_z));
+        __m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(oc_x, oc_x), _mm256_mul_ps(oc_y, oc_y)), _mm256_mul_ps(oc_z, oc_z));
+        c = _mm256_sub_ps(c, _mm256_mul_ps(r, r));
+
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(a, c));
+
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+                                     _mm256_cmp_ps(lane, _mm256_set1_ps((f32)(count - i)), _CMP_LT_OQ));
+        if(_mm256_movemask_ps(valid) == 0){
+            continue;
+        }
+
+        __m256 tmax      = _mm256_set1_ps(*closest);
+        __m256 disc_sqrt = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+
+        __m256 root_near = _mm256_div_ps(_mm256_sub_ps(h, disc_sqrt), a);
+        __m256 root_far  = _mm256_div_ps(_mm256_add_ps(h, disc_sqrt), a);
+
+        __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(root_near, tmin, _CMP_GT_OQ), _mm256_cmp_ps(root_near, tmax, _CMP_LT_OQ));
+        __m256 far_ok  = _mm256_and_ps(_mm256_cmp_ps(root_far, tmin, _CMP_GT_OQ), _mm256_cmp_ps(root_far, tmax, _CMP_LT_OQ));
+
+        __m256 root = _mm256_blendv_ps(root_far, root_near, near_ok);
+        i32 mask = _mm256_movemask_ps(_mm256_and_ps(valid, _mm256_or_ps(near_ok, far_ok)));
+
+        if(mask)
+        {
+            f32 roots[SPHERE_LANES];
+            _mm256_storeu_ps(roots, root);
+
+            for(u32 k = 0; k < SPHERE_LANES; k++)
+            {
+                if((mask & (1 << k)) && roots[k] < *closest)
+                {
+                    *closest  = roots[k];
+                    *hit_prim = base + k;
+                    hit_anything = true;
+                }
+            }
+        }
+    }
+
+    return hit_anything;
+}
+#endif
+
+bool hit_spheres(sphere_soa_t *spheres, u32 first, u32 count, ray_t *ray, f32 ray_tmin, f32 *closest, u32 *hit_prim)
+{
+    #ifdef __AVX__
+        return hit_spheres_avx(spheres, first, count, ray, ray_tmin, closest, hit_prim);
+    #else
+        return hit_spheres_scalar(spheres, first, count, ray, ray_tmin, closest, hit_prim);
+    #endif
+}
+
+/*
+    Any-hit version of hit_spheres_scalar(), stops at the first sphere
+    with a root inside (ray_tmin, ray_tmax) and never looks at which one it was.
+*/
+bool occluded_spheres_scalar(sphere_soa_t *spheres, u32 first, u32 count, ray_t *ray, f32 ray_tmin, f32 ray_tmax)
+{
+    f32 a = vec3f_length_sq(ray->dir);
+
+    for(u32 i = first; i < first + count; i++)
+    {
+        vec3f_t oc = vec3f_sub((vec3f_t){spheres->center_x[i], spheres->center_y[i], spheres->center_z[i]}, ray->orig);
+
+        f32 h = vec3f_dot(ray->dir, oc);
+        f32 c = vec3f_length_sq(oc) - spheres->radius[i] * spheres->radius[i];
+
+        f32 discriminant = h*h - a*c;
+        if(discriminant < 0){
+            continue;
+        }
+
+        f32 disc_sqrt = sqrt_f32(discriminant);
+
+        if(Surrounds((h - disc_sqrt) / a, ray_tmin, ray_tmax) || Surrounds((h + disc_sqrt) / a, ray_tmin, ray_tmax)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifdef __AVX__
+bool occluded_spheres_avx(sphere_soa_t *spheres, u32 first, u32 count, ray_t *ray, f32 ray_tmin, f32 ray_tmax)
+{
+    __m256 orig_x = _mm256_set1_ps(ray->orig.x);
+    __m256 orig_y = _mm256_set1_ps(ray->orig.y);
+    __m256 orig_z = _mm256_set1_ps(ray->orig.z);
+    __m256 dir_x  = _mm256_set1_ps(ray->dir.x);
+    __m256 dir_y  = _mm256_set1_ps(ray->dir.y);
+    __m256 dir_z  = _mm256_set1_ps(ray->dir.z);
+    __m256 a      = _mm256_set1_ps(vec3f_length_sq(ray->dir));
+    __m256 tmin   = _mm256_set1_ps(ray_tmin);
+    __m256 tmax   = _mm256_set1_ps(ray_tmax);
+    __m256 zero   = _mm256_setzero_ps();
+    __m256 lane   = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    for(u32 i = 0; i < count; i += SPHERE_LANES)
+    {
+        u32 base = first + i;
+
+        __m256 oc_x = _mm256_sub_ps(_mm256_loadu_ps(spheres->center_x + base), orig_x);
+        __m256 oc_y = _mm256_sub_ps(_mm256_loadu_ps(spheres->center_y + base), orig_y);
+        __m256 oc_z = _mm256_sub_ps(_mm256_loadu_ps(spheres->center_z + base), orig_z);
+        __m256 r    = _mm256_loadu_ps(spheres->radius + base);
+
+        __m256 h = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dir_x, oc_x), _mm256_mul_ps(dir_y, oc_y)), _mm256_mul_ps(dir_z, oc_z));
+        __m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(oc_x, oc_x), _mm256_mul_ps(oc_y, oc_y)), _mm256_mul_ps(oc_z, oc_z));
+        c = _mm256_sub_ps(c, _mm256_mul_ps(r, r));
+
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(a, c));
+
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+                                     _mm256_cmp_ps(lane, _mm256_set1_ps((f32)(count - i)), _CMP_LT_OQ));
+        if(_mm256_movemask_ps(valid) == 0){
+            continue;
+        }
+
+        __m256 disc_sqrt = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+
+        __m256 root_near = _mm256_div_ps(_mm256_sub_ps(h, disc_sqrt), a);
+        __m256 root_far  = _mm256_div_ps(_mm256_add_ps(h, disc_sqrt), a);
+
+        __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(root_near, tmin, _CMP_GT_OQ), _mm256_cmp_ps(root_near, tmax, _CMP_LT_OQ));
+        __m256 far_ok  = _mm256_and_ps(_mm256_cmp_ps(root_far, tmin, _CMP_GT_OQ), _mm256_cmp_ps(root_far, tmax, _CMP_LT_OQ));
+
+        if(_mm256_movemask_ps(_mm256_and_ps(valid, _mm256_or_ps(near_ok, far_ok)))){
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif
+
+bool occluded_spheres(sphere_soa_t *spheres, u32 first, u32 count, ray_t *ray, f32 ray_tmin, f32 ray_tmax)
+{
+    #ifdef __AVX__
+        return occluded_spheres_avx(spheres, first, count, ray, ray_tmin, ray_tmax);
+    #else
+        return occluded_spheres_scalar(spheres, first, count, ray, ray_tmin, ray_tmax);
+    #endif
+}
+
+/*
+    Slab test, returns the distance to where the ray enters the box
+    or max_f32 if it misses it within [ray_tmin, ray_tmax].
+*/
+f32 hit_aabb(aabb_t *box, ray_t *ray, vec3f_t inv_dir, f32 ray_tmin, f32 ray_tmax)
+{
+    f32 tx1 = (box->min.x - ray->orig.x) * inv_dir.x;
+    f32 tx2 = (box->max.x - ray->orig.x) * inv_dir.x;
+    f32 tmin = MIN(tx1, tx2);
+    f32 tmax = MAX(tx1, tx2);
+
+    f32 ty1 = (box->min.y - ray->orig.y) * inv_dir.y;
+    f32 ty2 = (box->max.y - ray->orig.y) * inv_dir.y;
+    tmin = MAX(tmin, MIN(ty1, ty2));
+    tmax = MIN(tmax, MAX(ty1, ty2));
+
+    f32 tz1 = (box->min.z - ray->orig.z) * inv_dir.z;
+    f32 tz2 = (box->max.z - ray->orig.z) * inv_dir.z;
+    tmin = MAX(tmin, MIN(tz1, tz2));
+    tmax = MIN(tmax, MAX(tz1, tz2));
+
+    tmin = MAX(tmin, ray_tmin);
+    tmax = MIN(tmax, ray_tmax);
+
+    return (tmin <= tmax) ? tmin : max_f32;
+}
+
+/*
+    Front to back traversal of the scene bvh, the nearer child is visited first
+    and the farther one is pushed with its entry distance so it can be culled
+    once a closer hit has been found.
+
+    Only the distance and the packed sphere index of the closest hit come out,
+    hit point, normal and material are left to sphere_surface() so they are
+    computed once for the winner instead of for every closer candidate.
+*/
+bool hit_closest(scene_objects_t *arr, ray_t *ray, f32 ray_tmin, f32 ray_tmax, f32 *hit_dist, u32 *hit_prim)
+{
+    bvh_t *bvh = &arr->bvh;
+
+    if(bvh->node_count == 0){
+        return false;
+    }
+
+    bool hit_anything = false;
+    f32 closest = ray_tmax;
+    u32 closest_prim = 0;
+    u32 nodes_visited = 0;
+    u32 sphere_tests  = 0;
+
+    vec3f_t inv_dir = {1.0f/ray->dir.x, 1.0f/ray->dir.y, 1.0f/ray->dir.z};
+
+    u32 stack[BVH_MAX_DEPTH];
+    f32 stack_dist[BVH_MAX_DEPTH];
+    u32 stack_ptr = 0;
+
+    if(hit_aabb(&bvh->nodes[0].bounds, ray, inv_dir, ray_tmin, closest) == max_f32){
+        return false;
+    }
+
+    bvh_node_t *node = &bvh->nodes[0];
+
+    for(;;)
+    {
+        nodes_visited++;
+
+        if(node->count > 0)
+        {
+            sphere_tests += node->count;
+            if(hit_spheres(&arr->spheres, node->left_first, node->count, ray, ray_tmin, &closest, &closest_prim))
+            {
+                hit_anything = true;
+            }
+        }
+        else
+        {
+            u32 near_idx = node->left_first;
+            u32 far_idx  = node->left_first + 1;
+
+            f32 near_dist = hit_aabb(&bvh->nodes[near_idx].bounds, ray, inv_dir, ray_tmin, closest);
+            f32 far_dist  = hit_aabb(&bvh->nodes[far_idx].bounds, ray, inv_dir, ray_tmin, closest);
+
+            if(near_dist > far_dist)
+            {
+                SWAP(near_idx, far_idx, u32);
+                SWAP(near_dist, far_dist, f32);
+            }
+
+            if(near_dist != max_f32)
+            {
+                if(far_dist != max_f32)
+                {
+                    stack[stack_ptr]      = far_idx;
+                    stack_dist[stack_ptr] = far_dist;
+                    stack_ptr++;
+                }
+                node = &bvh->nodes[near_idx];
+                continue;
+            }
+        }
+
+        // pop the next node that can still contain a closer hit
+        node = NULL;
+        while(stack_ptr > 0)
+        {
+            stack_ptr--;
+            if(stack_dist[stack_ptr] < closest)
+            {
+                node = &bvh->nodes[stack[stack_ptr]];
+                break;
+            }
+        }
+
+        if(!node){
+            break;
+        }
+    }
+
+    g_stats.bvh_nodes    += nodes_visited;
+    g_stats.sphere_tests += sphere_tests;
+
+    *hit_dist = closest;
+    *hit_prim = closest_prim;
+
+    return hit_anything;
+}
+
+bool hit(scene_objects_t *arr, ray_t *ray, f32 ray_tmin, f32 ray_tmax, hit_record_t *hit_info)
+{
+    f32 dist;
+    u32 prim;
+
+    if(!hit_closest(arr, ray, ray_tmin, ray_tmax, &dist, &prim)){
+        return false;
+    }
+
+    sphere_surface(arr, prim, ray, dist, hit_info);
+
+    return true;
+}
+
+/*
+    Is anything in the way between ray_tmin and ray_tmax, for shadow and visibility rays.
+    Any hit will do so children are visited in whatever order and the
+    first leaf with a hit ends the traversal, hit records and materials are never touched.
+*/
+bool occluded(scene_objects_t *arr, ray_t *ray, f32 ray_tmin, f32 ray_tmax)
+{
+    bvh_t *bvh = &arr->bvh;
+
+    if(bvh->node_count == 0){
+        return false;
+    }
+
+    vec3f_t inv_dir = {1.0f/ray->dir.x, 1.0f/ray->dir.y, 1.0f/ray->dir.z};
+
+    u32 stack[BVH_MAX_DEPTH];
+    u32 stack_ptr = 0;
+
+    if(hit_aabb(&bvh->nodes[0].bounds, ray, inv_dir, ray_tmin, ray_tmax) == max_f32){
+        return false;
+    }
+
+    stack[stack_ptr++] = 0;
+
+    u32 nodes_visited = 0;
+    u32 sphere_tests  = 0;
+    bool blocked = false;
+
+    while(stack_ptr > 0 && !blocked)
+    {
+        bvh_node_t *node = &bvh->nodes[stack[--stack_ptr]];
+        nodes_visited++;
+
+        if(node->count > 0)
+        {
+            sphere_tests += node->count;
+            blocked = occluded_spheres(&arr->spheres, node->left_first, node->count, ray, ray_tmin, ray_tmax);
+            continue;
+        }
+
+        for(u32 child = node->left_first; child < node->left_first + 2; child++)
+        {
+            if(hit_aabb(&bvh->nodes[child].bounds, ray, inv_dir, ray_tmin, ray_tmax) != max_f32){
+                stack[stack_ptr++] = child;
+            }
+        }
+    }
+
+    g_stats.bvh_nodes    += nodes_visited;
+    g_stats.sphere_tests += sphere_tests;
+
+    return blocked;
+}
+
+vec3f_t random_on_hemisphere(vec3f_t *normal)
+{
+    vec3f_t on_unit_sphere = vec3f_random_direction();
+    if(vec3f_dot(on_unit_sphere, *normal) > 0.0){
+        return on_unit_sphere;
+    }else{
+        return vec3f_scale(on_unit_sphere, -1.0f);
+    }
+}
+
+vec3f_t sky_color(ray_t *ray)
+{
+    vec3f_t unit_dir = vec3f_unit(ray->dir);
+
+    // gradient among the y-axis
+    f32 blend_factor = 0.5f * (unit_dir.y + 1.0f);
+
+    return vec3f_scale(vec3f_lerp(
+        (vec3f_t){1.0,1.0,1.0}, // white 
+        (vec3f_t){0.5,0.7,1.0}, // blue
+        blend_factor
+    ), gc.scene_objects->sky_intensity);
+}
+
+/*
+    Russian roulette: past gc.roulette_min_depth a path carries on with probability
+    p = max(throughput) and the survivors are divided by p, so the estimate stays
+    unbiased while paths that can't contribute much more stop early.
+    The draw is the first number of the bounce.
+*/
+bool roulette_survives(vec3f_t *throughput, i32 depth)
+{
+    if(!gc.russian_roulette || depth < gc.roulette_min_depth){
+        return true;
+    }
+
+    f32 p = MIN(ROULETTE_MAX_SURVIVAL, MAX3(throughput->x, throughput->y, throughput->z));
+
+    if(sampler_get_1d(&g_sampler) >= p){
+        g_stats.roulette_kills++;
+        return false;
+    }
+
+    *throughput = vec3f_scale(*throughput, 1.0f / p);
+    return true;
+}
+
+/*
+    Lights can be reached two ways: sampled directly at a diffuse hit, or hit by
+    the next bounce. Both estimates are kept and weighted with the power heuristic
+    (Veach's MIS), so small lights are found by the first and large or glossy ones
+    don't blow up its variance.
+*/
+f32 power_heuristic(f32 pdf, f32 other_pdf)
+{
+    f32 a = pdf * pdf;
+    f32 b = other_pdf * other_pdf;
+    return (a + b > 0.0f) ? a / (a + b) : 0.0f;
+}
+
+// solid angle pdf of light_sample() choosing this direction, from a point outside the sphere
+f32 light_pdf(scene_objects_t *arr, vec3f_t origin, vec3f_t center, f32 radius)
+{
+    f32 dist_sq = vec3f_length_sq(vec3f_sub(center, origin));
+    f32 sin2_max = (radius * radius) / dist_sq;
+
+    if(sin2_max >= 1.0f){
+        return 0.0f;    // inside the light, it can't be sampled from here
+    }
+
+    f32 cap_height = sin2_max / (1.0f + sqrt_f32(1.0f - sin2_max));   // 1 - cos(theta_max) without the cancellation
+    return 1.0f / ((f32)arr->light_count * 2.0f * (f32)M_PI * cap_height);
+}
+
+/*
+    Direct light at a lambertian hit: pick a light, sample the cone it subtends
+    and trace a shadow ray. Returns the radiance reflected towards the ray,
+    MIS weighted against the bsdf finding the same light.
+*/
+vec3f_t light_sample(scene_objects_t *arr, hit_record_t *rec, vec3f_t albedo)
+{
+    vec3f_t black = {0.0f, 0.0f, 0.0f};
+
+    if(arr->light_count == 0){
+        return black;
+    }
+
+    f32 u_light = sampler_get_1d(&g_sampler);
+    f32 u1, u2;
+    sampler_get_2d(&g_sampler, &u1, &u2);
+
+    light_t *light = &arr->lights[MIN((u32)(u_light * (f32)arr->light_count), arr->light_count - 1)];
+
+    vec3f_t to_center = vec3f_sub(light->center, rec->hit_point);
+    f32 dist_sq  = vec3f_length_sq(to_center);
+    f32 sin2_max = (light->radius * light->radius) / dist_sq;
+
+    if(sin2_max >= 1.0f){
+        return black;
+    }
+
+    f32 cap_height = sin2_max / (1.0f + sqrt_f32(1.0f - sin2_max));
+    vec3f_t dir = sample_uniform_cone(vec3f_scale(to_center, 1.0f / sqrt_f32(dist_sq)), cap_height, u1, u2);
+
+    f32 cos_surface = vec3f_dot(dir, rec->norm);
+    if(cos_surface <= 0.0f){
+        return black;
+    }
+
+    // nearer root of the light sphere along dir, the shadow ray stops just short of it
+    f32 h = vec3f_dot(dir, to_center);
+    f32 light_dist = h - sqrt_f32(fmaxf(0.0f, h * h - dist_sq + light->radius * light->radius));
+
+    ray_t shadow_ray = {rec->hit_point, dir};
+    g_stats.secondary_rays++;
+    if(occluded(arr, &shadow_ray, 0.001f, light_dist * 0.999f)){
+        return black;
+    }
+
+    f32 pdf_light = 1.0f / ((f32)arr->light_count * 2.0f * (f32)M_PI * cap_height);
+    f32 pdf_bsdf  = cos_surface / (f32)M_PI;
+
+    // albedo/pi * cos / pdf_light
+    f32 scale = pdf_bsdf * power_heuristic(pdf_light, pdf_bsdf) / pdf_light;
+    return vec3f_scale(vec3f_mul(albedo, scene_material(arr, light->mat_id)->emission), scale);
+}
+
+/*
+    Radiance of an emissive hit, bsdf_pdf is the pdf of the bounce that found it
+    or 0 when light sampling could not have (camera rays, specular bounces).
+*/
+vec3f_t light_emitted(scene_objects_t *arr, ray_t *ray, hit_record_t *rec, f32 bsdf_pdf)
+{
+    if(!rec->front_face){
+        return (vec3f_t){0.0f, 0.0f, 0.0f};
+    }
+
+    vec3f_t emission = scene_material(arr, rec->mat_id)->emission;
+
+    if(bsdf_pdf == 0.0f){
+        return emission;
+    }
+
+    sphere_t *sphere = (sphere_t *)arr->objects[rec->prim_id].object;
+    f32 pdf_light = light_pdf(arr, ray->orig, sphere->center, sphere->radius);
+
+    return vec3f_scale(emission, power_heuristic(bsdf_pdf, pdf_light));
+}
+
+vec3f_t ray_color(ray_t ray, int depth)
+{
+    scene_objects_t *scene = gc.scene_objects;
+
+    vec3f_t radiance   = {0.0f, 0.0f, 0.0f};
+    vec3f_t throughput = {1.0f, 1.0f, 1.0f};
+    f32 bsdf_pdf = 0.0f;
+    ray_t current_ray = ray;
+
+    for(int i = 0; i < depth; i++)
+    {
+        hit_record_t rec;
+
+        sampler_set_bounce(&g_sampler, (u32)i + 1);
+
+        if(!roulette_survives(&throughput, i)){
+            break;
+        }
+
+        g_stats.secondary_rays += (i > 0);
+        g_stats.bounces++;
+    
+        if(hit(scene, &current_ray, 0.001f, max_f32, &rec))
+        {
+            material_t *mat = scene_material(scene, rec.mat_id);
+
+            if(mat->mat_type == Emissive)
+            {
+                radiance = vec3f_add(radiance, vec3f_mul(throughput, light_emitted(scene, &current_ray, &rec, bsdf_pdf)));
+                break;
+            }
+
+            ray_t scattered;
+            vec3f_t attenuation;
+            if(!ray_scatter(&current_ray, &rec, &attenuation, &scattered))
+            {
+                break;  // absorbed
+            }
+
+            bsdf_pdf = 0.0f;
+            if(mat->mat_type == Lambertian && gc.light_sampling)
+            {
+                radiance = vec3f_add(radiance, vec3f_mul(throughput, light_sample(scene, &rec, mat->albedo)));
+                bsdf_pdf = fmaxf(0.0f, vec3f_dot(scattered.dir, rec.norm)) / (f32)M_PI;
+            }
+
+            throughput = vec3f_mul(throughput, attenuation);
+            current_ray = scattered;
+        }
+        else
+        {
+            g_stats.escaped++;
+            return vec3f_add(radiance, vec3f_mul(throughput, sky_color(&current_ray)));
+        }
+    
+    }
+    return radiance;
+}
+
+vec3f_t sample_square()
+{
+    // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
+    f32 u1, u2;
+    sampler_get_2d(&g_sampler, &u1, &u2);
+    return (vec3f_t){u1 - 0.5f, u2 - 0.5f, 0.0f};
+}
+
+// point (x,y) of the unit disk on the camera lens
+static inline vec3f_t defocus_disk_point(f32 x, f32 y)
+{
+    return vec3f_add(gc.camera.pos, vec3f_add(vec3f_scale(gc.camera.defocus_disk_u, x), vec3f_scale(gc.camera.defocus_disk_v, y)));
+}
+
+vec3f_t defocus_disk_sample()
+{
+    f32 u1, u2;
+    sampler_get_2d(&g_sampler, &u1, &u2);
+    vec3f_t p = sample_concentric_disk(u1, u2);
+    return defocus_disk_point(p.x, p.y);
+}
+
+// ray from ray_origin through pixel (x,y) moved by offset
+static ray_t camera_ray(int x, int y, vec3f_t offset, vec3f_t ray_origin)
+{
+
+    // current pixel (x,y) converted to normalized coordinated wrt to vp
+/*
+    vec3f_t pixel_center = {
+        .x = gc.pixel00_loc.x + (x * gc.pixel_delta_u.x) + (y * gc.pixel_delta_v.x),
+        .y = gc.pixel00_loc.y + (x * gc.pixel_delta_u.y) + (y * gc.pixel_delta_v.y),
+        .z = gc.pixel00_loc.z + (x * gc.pixel_delta_u.z) + (y * gc.pixel_delta_v.z)
+    };
+*/
+
+    // randomly sampled point around the pixel location i, j.
+    vec3f_t pixel_sample = {
+        .x = gc.pixel00_loc.x + ((x+offset.x) * gc.pixel_delta_u.x) + ((y+offset.y) * gc.pixel_delta_v.x),
+        .y = gc.pixel00_loc.y + ((x+offset.x) * gc.pixel_delta_u.y) + ((y+offset.y) * gc.pixel_delta_v.y),
+        .z = gc.pixel00_loc.z + ((x+offset.x) * gc.pixel_delta_u.z) + ((y+offset.y) * gc.pixel_delta_v.z)
+    };
+
+    // The vector from the camera center to the pixel center.
+    vec3f_t ray_dir = vec3f_sub(pixel_sample, ray_origin);
+
+    ray_t ray = {ray_origin, ray_dir};
+
+    return ray;
+}
+
+ray_t get_ray(int x, int y)
+{
+    vec3f_t offset = sample_square();
+    vec3f_t ray_origin = (gc.camera.defocus_angle <= 0 ) ? gc.camera.pos : defocus_disk_sample();
+
+    return camera_ray(x, y, offset, ray_origin);
+}
+
+void increase_fov() 
+{
+    gc.camera.vfov += 5.0f;
+    if (gc.camera.vfov > 120.0f) {
+        gc.camera.vfov = 120.0f; 
+    }
+    update_camera_view();
+}
+
+void decrease_fov() 
+{
+    gc.camera.vfov -= 5.0f;
+    if (gc.camera.vfov < 10.0f) {
+        gc.camera.vfov = 10.0f; 
+    }
+    update_camera_view();
+}
+
+void set_fov(f32 new_fov)
+{
+    gc.camera.vfov = new_fov;
+    if (gc.camera.vfov < 10.0f) gc.camera.vfov = 10.0f;
+    if (gc.camera.vfov > 120.0f) gc.camera.vfov = 120.0f;
+    update_camera_view();
+}
+
+void adjust_fov(f32 delta)
+{
+    gc.camera.vfov += delta;
+    if (gc.camera.vfov < 10.0f) gc.camera.vfov = 10.0f;
+    if (gc.camera.vfov > 120.0f) gc.camera.vfov = 120.0f;
+    update_camera_view();
+}
+
+void update_camera_view() 
+{
+    /* 
+        The viewport is a virtual rectangle in 3D space that represents our "screen"
+        All rays will be cast from camera through points on this viewport
+
+        The viewport height of 2.0 means the virtual screen is 2 world units tall
+        Viewport goes from -1 to +1 in both X and Y directions
+        camera_t at origin (0,0,0) looks at a 2×2 square centered at (0,0,-1)
+
+                                            (0,1)
+                                 ┌────────────┬───────────┐                         
+                                 │            │           │                         
+                                 │            │           │                         
+                                 │            │(0,0)      │                         
+                          (-1,0) |────────────┼───────────| (1,0)                       
+                                 │            │           │                         
+                                 │            │           │                         
+                                 │            │           │                         
+                                 └────────────┴───────────┘                         
+                                            (0,-1)
+                                     
+    */
+
+    // distance from camera to the viewport
+    // f32 focal_length = vec3f_length(vec3f_sub(gc.camera.pos, gc.camera.target));
+
+    f32 theta = radians_from_degrees_f32(gc.camera.vfov);
+    f32 h = tan_f32(theta/2.0f);
+
+    f32 vp_height = 2.0f * h * gc.camera.focus_dist;
+    f32 vp_width = vp_height * ((f32)gc.screen_width/(f32)gc.screen_height);
+
+    gc.camera.w = vec3f_unit(vec3f_sub(gc.camera.pos, gc.camera.target));
+    gc.camera.u = vec3f_unit(vec3f_cross(gc.camera.up, gc.camera.w));
+    gc.camera.v = vec3f_cross(gc.camera.w, gc.camera.u);
+
+    // define viewport orientation in world space
+    vec3f_t vp_u = vec3f_scale(gc.camera.u, vp_width);
+    vec3f_t vp_v = vec3f_scale(gc.camera.v, -vp_height);
+
+    // how much to move in world space when moving one pixel
+    // mapping between screen pixels and viewport coordinates
+    gc.pixel_delta_u = vec3f_scale(vp_u, 1.0f/(f32)gc.screen_width);
+    gc.pixel_delta_v = vec3f_scale(vp_v, 1.0f/(f32)gc.screen_height);
+
+    // positioned relative to the camera center
+    // shifted left by half the width 
+    // and up by half the height
+    // and back by focal length
+    vec3f_t viewport_center = vec3f_sub(gc.camera.pos, vec3f_scale(gc.camera.w, gc.camera.focus_dist));
+    vec3f_t vp_upper_left = vec3f_sub(viewport_center, 
+                                      vec3f_add(vec3f_scale(vp_u, 0.5f), 
+                                               vec3f_scale(vp_v, 0.5f)));
+
+
+    // calculate the center of the first pixel normalized to the viewport
+    gc.pixel00_loc = vec3f_add(vp_upper_left, 
+                      vec3f_add(vec3f_scale(gc.pixel_delta_u, 0.5f), 
+                               vec3f_scale(gc.pixel_delta_v, 0.5f)));
+    
+    f32 defocus_radius = gc.camera.focus_dist * tan_f32(radians_from_degrees_f32(gc.camera.defocus_angle / 2));
+    gc.camera.defocus_disk_u = vec3f_scale(gc.camera.u, defocus_radius);
+    gc.camera.defocus_disk_v = vec3f_scale(gc.camera.v, defocus_radius);
+
+    reset_accumulation();
+
+}
+
+void init_camera(int window_width, f32 aspect_ratio)
+{
+    u32 window_height = (u32)(window_width / aspect_ratio);
+
+    assert(window_height > 1);
+
+    gc.screen_width  = window_width;
+    gc.screen_height = window_height;
+
+    gc.camera.pos = (vec3f_t){13.0f, 2.0f, 3.0f};
+    gc.camera.target = (vec3f_t){0.0f, 0.0f, 0.0f};
+    gc.camera.up = (vec3f_t){0.0f, 1.0f, 0.0f};
+    gc.camera.vfov  = 60.0f;
+    gc.camera.speed = 2.0f;
+
+    gc.camera.defocus_angle = 0.6f;
+    gc.camera.focus_dist = 10.0f;
+
+    update_camera_view();
+
+    gc.samples_per_pixel = 10;
+    gc.samples_per_frame = 1;
+    gc.max_depth = 20;
+
+    gc.adaptive_error       = 0.05f;
+    gc.adaptive_min_samples = 8;
+
+    gc.sampler = SamplerSobol;
+    gc.light_sampling = true;
+
+    gc.russian_roulette   = true;
+    gc.roulette_min_depth = 3;
+}
+
+
+/*
+    Request the accumulated image to be thrown away before the next frame,
+    anything that changes what a pixel converges to must call this.
+*/
+void reset_accumulation(void)
+{
+    gc.accum_reset = true;
+}
+
+f32 luminance(vec3f_t color)
+{
+    return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
+/*
+    A pixel is done once the standard error of its mean luminance is below
+    adaptive_error relative to the mean, dark pixels use a small floor
+    so they don't chase a relative error on an almost zero mean forever.
+*/
+bool pixel_converged(accum_pixel_t *pixel)
+{
+    if (gc.adaptive_error <= 0.0f || pixel->count < (u32)gc.adaptive_min_samples) {
+        return false;
+    }
+
+    f32 n        = (f32)pixel->count;
+    f32 mean     = luminance(pixel->sum) / n;
+    f32 variance = MAX(0.0f, (pixel->lum_sq - mean * mean * n) / (n - 1.0f));
+    f32 std_err  = sqrt_f32(variance / n);
+
+    return std_err <= gc.adaptive_error * MAX(mean, 0.01f);
+}
+
+// black -> red -> yellow -> white as t goes 0 -> 1
+vec3f_t heatmap_color(f32 t)
+{
+    t = Clamp(0.0f, t, 1.0f) * 3.0f;
+    return (vec3f_t){Clamp(0.0f, t, 1.0f), Clamp(0.0f, t - 1.0f, 1.0f), Clamp(0.0f, t - 2.0f, 1.0f)};
+}
+
+void resolve_pixel(tile_data_t *tile, u32 x, u32 y, accum_pixel_t *pixel)
+{
+    vec3f_t color;
+    if (gc.show_sample_count)
+    {
+        color = heatmap_color((f32)pixel->count / (f32)tile->max_samples);
+    }
+    else
+    {
+        color = (pixel->count > 0) ? vec3f_scale(pixel->sum, 1.0f/(f32)pixel->count) : (vec3f_t){0};
+        color = linear_to_gamma(color);
+    }
+    set_pixel(&gc.draw_buffer, x, y, to_color4(color));
+}
+
+void render_tile(void *data) 
+{
+    tile_data_t *tile = (tile_data_t *)data;
+
+    u64 samples_taken = 0;
+    g_stats = (render_stats_t){0};
+    
+    for (u32 y = tile->start_y; y < tile->end_y; ++y) 
+    {
+        if (ATOMIC_LOAD_U32(&gc.frame_cancel)) {
+            break;
+        }
+
+        for (u32 x = tile->start_x; x < tile->end_x; ++x) 
+        {
+            accum_pixel_t *pixel = &gc.accum_buffer[x + y * tile->width];
+
+            u32 samples = 0;
+            if (pixel->count < tile->max_samples && !pixel_converged(pixel)) {
+                samples = MIN((u32)tile->samples, tile->max_samples - pixel->count);
+            }
+
+            for (u32 sample = 0; sample < samples; sample++) 
+            {
+                // samples are numbered since the last reset so every frame adds new ones
+                sampler_start(&g_sampler, gc.sampler, x, y, x + y * tile->width,
+                              pixel->count + sample, (u32)gc.samples_per_pixel, RENDER_SEED);
+
+                ray_t ray = get_ray(x, y);
+                u64 bounces_start = g_stats.bounces;
+                vec3f_t radiance = ray_color(ray, gc.max_depth);
+                f32 lum = luminance(radiance);
+
+                g_stats.primary_rays++;
+                g_stats.max_path_depth = MAX(g_stats.max_path_depth, (u32)(g_stats.bounces - bounces_start));
+
+                pixel->sum     = vec3f_add(pixel->sum, radiance);
+                pixel->lum_sq += lum * lum;
+            }
+
+            pixel->count  += samples;
+            samples_taken += samples;
+
+            resolve_pixel(tile, x, y, pixel);
+        }
+    }
+
+    tile->samples_taken = samples_taken;
+    tile->stats         = g_stats;
+}
+
+/*
+    Same output as render_tile() but instead of following one path to the end
+    before starting the next, every pixel of the tile shoots a sample at once and
+    the whole wave goes through each stage together:
+
+        intersect -> miss shading -> scatter (grouped by material) -> compact
+
+    keeping each stage's code and data hot and making the loops easy to batch.
+*/
+void render_tile_wavefront(void *data)
+{
+    tile_data_t *tile = (tile_data_t *)data;
+
+    // a tile's worth of paths per worker, kept for the life of the pool
+    wavefront_t *wf = thread_pool_scratch(sizeof(wavefront_t));
+
+    u32 tile_w = tile->end_x - tile->start_x;
+    u32 tile_h = tile->end_y - tile->start_y;
+    u32 pixel_count = tile_w * tile_h;
+
+    u32 max_pixel_samples = 0;
+    u64 samples_taken = 0;
+    g_stats = (render_stats_t){0};
+
+    for (u32 i = 0; i < pixel_count; i++)
+    {
+        accum_pixel_t *pixel = &gc.accum_buffer[(tile->start_x + i % tile_w) + (tile->start_y + i / tile_w) * tile->width];
+
+        wf->samples[i] = 0;
+        if (pixel->count < tile->max_samples && !pixel_converged(pixel)) {
+            wf->samples[i] = MIN((u32)tile->samples, tile->max_samples - pixel->count);
+        }
+        max_pixel_samples = MAX(max_pixel_samples, wf->samples[i]);
+    }
+
+    for (u32 sample = 0; sample < max_pixel_samples; sample++)
+    {
+        // the samples already through the wave are in the buffer, only count those
+        if (ATOMIC_LOAD_U32(&gc.frame_cancel))
+        {
+            for (u32 i = 0; i < pixel_count; i++) {
+                wf->samples[i] = MIN(wf->samples[i], sample);
+            }
+            break;
+        }
+
+        path_state_t *paths = wf->queues[0];
+        u32 path_count = 0;
+
+        // generate camera rays for every pixel still taking samples
+        for (u32 i = 0; i < pixel_count; i++)
+        {
+            if (wf->samples[i] <= sample) {
+                continue;
+            }
+            wf->radiance[i] = (vec3f_t){0.0f, 0.0f, 0.0f};
+
+            u32 x = tile->start_x + i % tile_w;
+            u32 y = tile->start_y + i / tile_w;
+
+            // same numbers as render_tile() draws for this sample
+            sampler_start(&g_sampler, gc.sampler, x, y, x + y * tile->width,
+                          gc.accum_buffer[x + y * tile->width].count, (u32)gc.samples_per_pixel, RENDER_SEED);
+
+            path_state_t *path = &paths[path_count++];
+            path->throughput = (vec3f_t){1.0f, 1.0f, 1.0f};
+            path->sampler    = g_sampler;
+            path->bsdf_pdf   = 0.0f;
+            path->pixel      = i;
+        }
+        g_stats.primary_rays += path_count;
+
+        // camera rays, the same draws as get_ray() with the lens points mapped 8 at a time
+        bool defocus = gc.camera.defocus_angle > 0;
+        for (u32 j = 0; j < path_count; j += 8)
+        {
+            u32 lanes = MIN(8, path_count - j);
+
+            vec3f_t offset[8];
+            f32 u1[8] = {0}, u2[8] = {0};
+            f32 lx[8], ly[8];
+
+            for (u32 k = 0; k < lanes; k++)
+            {
+                g_sampler = paths[j + k].sampler;
+                offset[k] = sample_square();
+                if (defocus) {
+                    sampler_get_2d(&g_sampler, &u1[k], &u2[k]);
+                }
+                paths[j + k].sampler = g_sampler;
+            }
+
+            if (defocus) {
+                sample_concentric_disk_x8(u1, u2, lx, ly);
+            }
+
+            for (u32 k = 0; k < lanes; k++)
+            {
+                path_state_t *path = &paths[j + k];
+                vec3f_t origin = defocus ? defocus_disk_point(lx[k], ly[k]) : gc.camera.pos;
+
+                path->ray = camera_ray(tile->start_x + path->pixel % tile_w, tile->start_y + path->pixel / tile_w, offset[k], origin);
+            }
+        }
+
+        for (i32 depth = 0; depth < gc.max_depth && path_count > 0; depth++)
+        {
+            path_state_t *next_paths = wf->queues[(depth + 1) & 1];
+            u32 next_count = 0;
+
+            // every draw of the bounce continues from here, roulette first
+            for (u32 i = 0; i < path_count; i++) {
+                sampler_set_bounce(&paths[i].sampler, (u32)depth + 1);
+            }
+
+            // russian roulette, before intersecting so a killed path costs no ray
+            if (gc.russian_roulette && depth >= gc.roulette_min_depth)
+            {
+                u32 alive = 0;
+                for (u32 i = 0; i < path_count; i++)
+                {
+                    g_sampler = paths[i].sampler;
+                    if (roulette_survives(&paths[i].throughput, depth))
+                    {
+                        paths[alive] = paths[i];
+                        paths[alive].sampler = g_sampler;
+                        alive++;
+                    }
+                }
+                path_count = alive;
+            }
+
+            // intersect, distances only
+            if (depth > 0) {
+                g_stats.secondary_rays += path_count;
+            }
+            if (path_count > 0) {
+                g_stats.max_path_depth = MAX(g_stats.max_path_depth, (u32)depth + 1);
+            }
+            g_stats.bounces += path_count;
+            for (u32 i = 0; i < path_count; i++)
+            {
+                wf->hit_mask[i] = hit_closest(gc.scene_objects, &paths[i].ray, 0.001f, max_f32, &wf->hit_dist[i], &wf->hit_prim[i]);
+            }
+
+            // surface of the closest hits
+            u32 type_count[MaterialTypeCount] = {0};
+            for (u32 i = 0; i < path_count; i++)
+            {
+                if (wf->hit_mask[i]) {
+                    sphere_surface(gc.scene_objects, wf->hit_prim[i], &paths[i].ray, wf->hit_dist[i], &wf->hits[i]);
+                    type_count[scene_material(gc.scene_objects, wf->hits[i].mat_id)->mat_type]++;
+                }
+            }
+
+            // miss shading, escaped paths pick up the sky and terminate, so do paths that hit a light
+            for (u32 i = 0; i < path_count; i++)
+            {
+                vec3f_t *radiance = &wf->radiance[paths[i].pixel];
+
+                if (!wf->hit_mask[i]) {
+                    *radiance = vec3f_add(*radiance, vec3f_mul(paths[i].throughput, sky_color(&paths[i].ray)));
+                    g_stats.escaped++;
+                } else if (scene_material(gc.scene_objects, wf->hits[i].mat_id)->mat_type == Emissive) {
+                    vec3f_t emitted = light_emitted(gc.scene_objects, &paths[i].ray, &wf->hits[i], paths[i].bsdf_pdf);
+                    *radiance = vec3f_add(*radiance, vec3f_mul(paths[i].throughput, emitted));
+                }
+            }
+
+            // counting sort of the hits by material so each scatter branch runs back to back
+            u32 type_offset[MaterialTypeCount];
+            u32 offset = 0;
+            for (u32 t = 0; t < MaterialTypeCount; t++) {
+                type_offset[t] = offset;
+                offset += type_count[t];
+            }
+            for (u32 i = 0; i < path_count; i++)
+            {
+                if (wf->hit_mask[i]) {
+                    wf->order[type_offset[scene_material(gc.scene_objects, wf->hits[i].mat_id)->mat_type]++] = i;
+                }
+            }
+
+            // scatter, surviving paths are compacted into the next queue
+
+            // lambertian hits sort first, their bounce directions are drawn 8 at a time
+            u32 lambertian_count = type_count[Lambertian];
+            for (u32 j = 0; j < lambertian_count; j += 8)
+            {
+                u32 lanes = MIN(8, lambertian_count - j);
+
+                f32 nx[8] = {0}, ny[8] = {0}, nz[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+                f32 u1[8] = {0}, u2[8] = {0};
+                f32 dx[8], dy[8], dz[8];
+
+                for (u32 k = 0; k < lanes; k++)
+                {
+                    u32 i = wf->order[j + k];
+
+                    // same draws as ray_scatter() would make for this path
+                    sampler_get_2d(&paths[i].sampler, &u1[k], &u2[k]);
+
+                    nx[k] = wf->hits[i].norm.x;
+                    ny[k] = wf->hits[i].norm.y;
+                    nz[k] = wf->hits[i].norm.z;
+                }
+
+                sample_cosine_hemisphere_x8(nx, ny, nz, u1, u2, dx, dy, dz);
+
+                for (u32 k = 0; k < lanes; k++)
+                {
+                    u32 i = wf->order[j + k];
+                    path_state_t *path = &paths[i];
+                    hit_record_t *rec  = &wf->hits[i];
+                    vec3f_t albedo = scene_material(gc.scene_objects, rec->mat_id)->albedo;
+
+                    path_state_t *next = &next_paths[next_count++];
+                    next->ray        = (ray_t){rec->hit_point, (vec3f_t){dx[k], dy[k], dz[k]}};
+                    next->throughput = vec3f_mul(path->throughput, albedo);
+                    next->bsdf_pdf   = 0.0f;
+                    next->pixel      = path->pixel;
+
+                    // direct light continues the draws of the bounce, as in ray_color()
+                    g_sampler = path->sampler;
+                    if (gc.light_sampling)
+                    {
+                        vec3f_t *radiance = &wf->radiance[path->pixel];
+                        *radiance = vec3f_add(*radiance, vec3f_mul(path->throughput, light_sample(gc.scene_objects, rec, albedo)));
+                        next->bsdf_pdf = fmaxf(0.0f, vec3f_dot(next->ray.dir, rec->norm)) / (f32)M_PI;
+                    }
+                    next->sampler = g_sampler;
+                }
+            }
+
+            // metal hits sort next, the fuzz offsets are drawn 8 at a time the same way
+            u32 metal_end = lambertian_count + type_count[Metal];
+            for (u32 j = lambertian_count; j < metal_end; j += 8)
+            {
+                u32 lanes = MIN(8, metal_end - j);
+
+                f32 u1[8] = {0}, u2[8] = {0};
+                f32 fx[8], fy[8], fz[8];
+
+                for (u32 k = 0; k < lanes; k++) {
+                    sampler_get_2d(&paths[wf->order[j + k]].sampler, &u1[k], &u2[k]);
+                }
+
+                sample_uniform_sphere_x8(u1, u2, fx, fy, fz);
+
+                for (u32 k = 0; k < lanes; k++)
+                {
+                    u32 i = wf->order[j + k];
+                    path_state_t *path = &paths[i];
+                    hit_record_t *rec  = &wf->hits[i];
+                    material_t   *mat  = scene_material(gc.scene_objects, rec->mat_id);
+
+                    // as in ray_scatter(), fuzzed directions below the surface are absorbed
+                    vec3f_t reflected = vec3f_unit(vec3f_reflect(path->ray.dir, rec->norm));
+                    reflected = vec3f_add(reflected, vec3f_scale((vec3f_t){fx[k], fy[k], fz[k]}, mat->fuzz));
+                    if (vec3f_dot(reflected, rec->norm) <= 0) {
+                        continue;
+                    }
+
+                    path_state_t *next = &next_paths[next_count++];
+                    next->ray        = (ray_t){rec->hit_point, reflected};
+                    next->throughput = vec3f_mul(path->throughput, mat->albedo);
+                    next->sampler    = path->sampler;
+                    next->bsdf_pdf   = 0.0f;
+                    next->pixel      = path->pixel;
+                }
+            }
+
+            // emissive hits sort last and end their paths
+            u32 scatter_end = offset - type_count[Emissive];
+            for (u32 j = metal_end; j < scatter_end; j++)
+            {
+                u32 i = wf->order[j];
+                path_state_t *path = &paths[i];
+
+                g_sampler = path->sampler;
+
+                ray_t scattered;
+                vec3f_t attenuation;
+                if (ray_scatter(&path->ray, &wf->hits[i], &attenuation, &scattered))
+                {
+                    path_state_t *next = &next_paths[next_count++];
+                    next->ray        = scattered;
+                    next->throughput = vec3f_mul(path->throughput, attenuation);
+                    next->sampler    = g_sampler;
+                    next->bsdf_pdf   = 0.0f;
+                    next->pixel      = path->pixel;
+                }
+            }
+
+            paths      = next_paths;
+            path_count = next_count;
+        }
+
+        // paths left after max_depth contribute nothing, same as ray_color()
+        for (u32 i = 0; i < pixel_count; i++)
+        {
+            if (wf->samples[i] <= sample) {
+                continue;
+            }
+            accum_pixel_t *pixel = &gc.accum_buffer[(tile->start_x + i % tile_w) + (tile->start_y + i / tile_w) * tile->width];
+            f32 lum = luminance(wf->radiance[i]);
+
+            pixel->sum     = vec3f_add(pixel->sum, wf->radiance[i]);
+            pixel->lum_sq += lum * lum;
+            pixel->count++;
+        }
+    }
+
+    for (u32 i = 0; i < pixel_count; i++)
+    {
+        u32 x = tile->start_x + i % tile_w;
+        u32 y = tile->start_y + i / tile_w;
+
+        samples_taken += wf->samples[i];
+        resolve_pixel(tile, x, y, &gc.accum_buffer[x + y * tile->width]);
+    }
+
+    tile->samples_taken = samples_taken;
+    tile->stats         = g_stats;
+}
+
+// what the thread pool runs, one profile zone per tile on whichever worker took it
+void trace_tile(void *data)
+{
+    if (gc.wavefront)
+    {
+        PROFILE("Tracing tile (wavefront)")
+        {
+            render_tile_wavefront(data);
+        }
+    }
+    else
+    {
+        PROFILE("Tracing tile")
+        {
+            render_tile(data);
+        }
+    }
+}
+
+void update_accumulation_buffer(u32 width, u32 height)
+{
+    if (gc.accum_width != width || gc.accum_height != height)
+    {
+        free(gc.accum_buffer);
+        gc.accum_buffer = CHECK_PTR(malloc(width * height * sizeof(accum_pixel_t)));
+        gc.accum_width  = width;
+        gc.accum_height = height;
+        gc.accum_reset  = true;
+    }
+
+    if (gc.accum_reset)
+    {
+        memset(gc.accum_buffer, 0, width * height * sizeof(accum_pixel_t));
+        gc.accum_frames    = 0;
+        gc.accum_spent     = 0;
+        gc.accum_converged = false;
+        gc.accum_reset     = false;
+    }
+}
+
+void render_frame_begin(void)
+{
+    if(gc.scene_objects->bvh_dirty)
+    {
+        PROFILE("Building BVH")
+        {
+            scene_array_build_bvh(gc.scene_objects);
+        }
+        reset_accumulation();
+    }
+
+    gc.draw_buffer.height = gc.screen_height;
+    gc.draw_buffer.width  = gc.screen_width;
+
+    u32 height  = gc.draw_buffer.height;
+    u32 width   = gc.draw_buffer.width;
+
+    gc.draw_buffer.pixels = gc.frame_target ? gc.frame_target : ARENA_ALLOC(gc.frame_arena, height * width * sizeof(color4_t));
+
+    clear_screen(&gc.draw_buffer, HEX_TO_COLOR4(0x282a36));
+
+    update_accumulation_buffer(width, height);
+
+    /*
+        Keep refining while the view is still, once the budget is spent we only resolve the buffer.
+        With adaptive sampling pixels that converge early stop taking samples
+        and the budget they leave goes to the noisy ones, up to a per pixel cap.
+    */
+    u64 budget = (u64)gc.samples_per_pixel * width * height;
+    u32 max_samples = (u32)gc.samples_per_pixel;
+    if (gc.adaptive_error > 0.0f) {
+        max_samples *= ADAPTIVE_MAX_SPP_SCALE;
+    }
+
+    gc.frame_samples = (gc.accum_converged || gc.accum_spent >= budget) ? 0 : gc.samples_per_frame;
+
+    const u32 tile_size = TILE_SIZE;
+
+    u32 tiles_x = CEIL_DIV(width, tile_size);
+    u32 tiles_y = CEIL_DIV(height, tile_size);
+    u32 total_tiles = tiles_x * tiles_y;
+
+    tile_data_t* tiles = ARENA_ALLOC(gc.frame_arena, total_tiles * sizeof(tile_data_t));
+
+    i32 tile_idx = 0;
+    
+    for (u32 ty = 0; ty < tiles_y; ty++) 
+    {
+        u32 start_y = ty * tile_size;
+        u32 end_y = (start_y + tile_size > height) ? height : start_y + tile_size;
+        
+        for (u32 tx = 0; tx < tiles_x; tx++) 
+        {
+            u32 start_x = tx * tile_size;
+            u32 end_x = (start_x + tile_size > width) ? width : start_x + tile_size;
+            
+            tiles[tile_idx] = (tile_data_t){
+                .start_x = start_x, .end_x = end_x,
+                .start_y = start_y, .end_y = end_y,
+                .width = width, .height = height,
+                .samples = gc.frame_samples,
+                .max_samples = max_samples
+            };
+            
+            tile_idx++;
+        }
+    }
+
+    gc.tiles      = tiles;
+    gc.tile_count = total_tiles;
+
+    // workers claim tiles in order as they become free
+    thread_pool_dispatch(gc.thread_pool, trace_tile, tiles, total_tiles, sizeof(tile_data_t));
+}
+
+void render_stats_add(render_stats_t *total, render_stats_t *stats)
+{
+    total->primary_rays   += stats->primary_rays;
+    total->secondary_rays += stats->secondary_rays;
+    total->bounces        += stats->bounces;
+    total->escaped        += stats->escaped;
+    total->roulette_kills += stats->roulette_kills;
+    total->sphere_tests   += stats->sphere_tests;
+    total->bvh_nodes      += stats->bvh_nodes;
+    total->max_path_depth  = MAX(total->max_path_depth, stats->max_path_depth);
+}
+
+bool render_frame_end(void)
+{
+    thread_pool_wait(gc.thread_pool);
+
+    bool cancelled = ATOMIC_LOAD_U32(&gc.frame_cancel) != 0;
+
+    u64 frame_taken = 0;
+    gc.frame_stats  = (render_stats_t){0};
+    for (u32 i = 0; i < gc.tile_count; i++) {
+        frame_taken += gc.tiles[i].samples_taken;
+        render_stats_add(&gc.frame_stats, &gc.tiles[i].stats);
+    }
+
+    gc.accum_spent += frame_taken;
+    gc.accum_frames++;
+    if (gc.frame_samples > 0 && frame_taken == 0 && !cancelled) {
+        gc.accum_converged = true;
+    }
+
+    gc.tiles      = NULL;
+    gc.tile_count = 0;
+
+    return !cancelled;
+}
+
+sphere_t ground_sphere;
+sphere_t large_sphere_1;     // glass sphere at center
+sphere_t large_sphere_2;     // brown lambertian sphere
+sphere_t large_sphere_3;     // metal sphere
+sphere_t small_spheres[484]; // 22x22 grid, but some will be skipped
+
+const char *scene_names[SceneCount] = {
+    [SceneSpheres]      = "spheres",
+    [SceneRandomField]  = "random_field",
+    [SceneGlass]        = "glass",
+    [SceneLights]       = "lights",
+};
+
+void add_ground(scene_objects_t *array)
+{
+    ground_sphere = (sphere_t){
+        .mat_id = (u32)scene_array_add_material(array, (material_t){
+            .mat_type = Lambertian,
+            .albedo = {0.5f, 0.5f, 0.5f}
+        }),
+        .center = (vec3f_t){0.0f, -1000.0f, 0.0f},
+        .radius = 1000.0f
+    };
+    scene_array_add(array, (scene_object_t){.type=Sphere, .object=&ground_sphere});
+}
+
+void add_large_spheres(scene_objects_t *array)
+{
+    large_sphere_1 = (sphere_t){
+        .mat_id = (u32)scene_array_add_material(array, (material_t){
+            .mat_type = Dielectric,
+            .refraction_index = 1.5f
+        }),
+        .center = (vec3f_t){0.0f, 1.0f, 0.0f},
+        .radius = 1.0f
+    };
+    scene_array_add(array, (scene_object_t){.type=Sphere, .object=&large_sphere_1});
+    
+    large_sphere_2 = (sphere_t){
+        .mat_id = (u32)scene_array_add_material(array, (material_t){
+            .mat_type = Lambertian,
+            .albedo = {0.4f, 0.2f, 0.1f}
+        }),
+        .center = (vec3f_t){-4.0f, 1.0f, 0.0f},
+        .radius = 1.0f
+    };
+    scene_array_add(array, (scene_object_t){.type=Sphere, .object=&large_sphere_2});
+    
+    large_sphere_3 = (sphere_t){
+        .mat_id = (u32)scene_array_add_material(array, (material_t){
+            .mat_type = Metal,
+            .albedo = {0.7f, 0.6f, 0.5f},
+            .fuzz = 0.0f
+        }),
+        .center = (vec3f_t){4.0f, 1.0f, 0.0f},
+        .radius = 1.0f
+    };
+    scene_array_add(array, (scene_object_t){.type=Sphere, .object=&large_sphere_3});
+}
+
+void add_random_field(scene_objects_t *array)
+{
+    u32 glass = (u32)scene_array_add_material(array, (material_t){
+        .mat_type = Dielectric,
+        .refraction_index = 1.5f
+    });
+
+    // Generate small random spheres
+    int sphere_count = 0;
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            f32 choose_mat = RAND_FLOAT();
+            vec3f_t center = (vec3f_t){
+                a + 0.9f * RAND_FLOAT(), 
+                0.2f, 
+                b + 0.9f * RAND_FLOAT()
+            };
+            
+            // Check distance from point (4, 0.2, 0)
+            vec3f_t reference_point = (vec3f_t){4.0f, 0.2f, 0.0f};
+            vec3f_t diff = vec3f_sub(center, reference_point);
+            if (vec3f_length(diff) > 0.9f) {
+                if (choose_mat < 0.8f) {
+                    // Diffuse material
+                    vec3f_t albedo = vec3f_mul(vec3f_random(), vec3f_random());
+                    small_spheres[sphere_count] = (sphere_t){
+                        .mat_id = (u32)scene_array_add_material(array, (material_t){
+                            .mat_type = Lambertian,
+                            .albedo = albedo
+                        }),
+                        .center = center,
+                        .radius = 0.2f
+                    };
+                } else if (choose_mat < 0.95f) {
+                    // Metal material
+                    vec3f_t albedo = vec3f_random_range(0.5f, 1.0f);
+                    f32 fuzz = RAND_FLOAT_RANGE(0.0f, 0.5f);
+                    small_spheres[sphere_count] = (sphere_t){
+                        .mat_id = (u32)scene_array_add_material(array, (material_t){
+                            .mat_type = Metal,
+                            .albedo = albedo,
+                            .fuzz = fuzz
+                        }),
+                        .center = center,
+                        .radius = 0.2f
+                    };
+                } else {
+                    // Glass material
+                    small_spheres[sphere_count] = (sphere_t){
+                        .mat_id = glass,
+                        .center = center,
+                        .radius = 0.2f
+                    };
+                }
+                
+                scene_array_add(array, (scene_object_t){
+                    .type = Sphere, 
+                    .object = &small_spheres[sphere_count]
+                });
+                sphere_count++;
+            }
+        }
+    }
+}
+
+/*
+    Every ray that hits glass keeps bouncing until it escapes or runs out of depth,
+    a dense grid of them makes for long paths and lots of refraction/reflection work.
+*/
+void add_glass_field(scene_objects_t *array)
+{
+    // every sphere of the grid shares one of two materials
+    u32 glass = (u32)scene_array_add_material(array, (material_t){
+        .mat_type = Dielectric,
+        .refraction_index = 1.5f
+    });
+    u32 water = (u32)scene_array_add_material(array, (material_t){
+        .mat_type = Dielectric,
+        .refraction_index = 1.33f
+    });
+
+    int sphere_count = 0;
+    for (int a = -5; a <= 5; a++) {
+        for (int b = -5; b <= 5; b++) {
+            small_spheres[sphere_count] = (sphere_t){
+                .mat_id = ((a + b) & 1) ? glass : water,
+                .center = (vec3f_t){a * 1.1f, 0.5f, b * 1.1f},
+                .radius = 0.5f
+            };
+            scene_array_add(array, (scene_object_t){
+                .type = Sphere, 
+                .object = &small_spheres[sphere_count]
+            });
+            sphere_count++;
+        }
+    }
+
+    large_sphere_1 = (sphere_t){
+        .mat_id = glass,
+        .center = (vec3f_t){0.0f, 2.5f, 0.0f},
+        .radius = 1.5f
+    };
+    scene_array_add(array, (scene_object_t){.type=Sphere, .object=&large_sphere_1});
+}
+
+/*
+    Small bright spheres around the large ones with the sky almost off,
+    nearly all the light arrives through a few tiny sources that a bounce
+    only finds by luck.
+*/
+void add_small_lights(scene_objects_t *array)
+{
+    static const struct { vec3f_t center; f32 radius; vec3f_t emission; } lights[] = {
+        {{ 2.0f, 0.3f,  1.6f}, 0.3f, {16.0f, 10.0f,  4.0f}},    // warm, between the glass and metal spheres
+        {{-2.0f, 0.3f, -1.6f}, 0.3f, { 4.0f,  8.0f, 16.0f}},    // cool, behind the diffuse sphere
+        {{ 0.0f, 2.6f,  0.0f}, 0.2f, {30.0f, 30.0f, 30.0f}},    // above the glass sphere
+        {{ 6.0f, 0.2f, -2.0f}, 0.2f, {20.0f,  6.0f,  6.0f}},
+    };
+
+    static sphere_t light_spheres[NUM_ELEMS(lights)];
+
+    for (u32 i = 0; i < NUM_ELEMS(lights); i++)
+    {
+        light_spheres[i] = (sphere_t){
+            .mat_id = (u32)scene_array_add_material(array, (material_t){
+                .mat_type = Emissive,
+                .emission = lights[i].emission
+            }),
+            .center = lights[i].center,
+            .radius = lights[i].radius
+        };
+        scene_array_add(array, (scene_object_t){.type=Sphere, .object=&light_spheres[i]});
+    }
+
+    array->sky_intensity = 0.02f;
+}
+
+/*
+    Replace the current scene, the random ones always use the same seed
+    so a scene looks the same in every run.
+*/
+void init_scene(enum scene_id id)
+{
+    scene_array_destroy(&gc.scene_objects);
+    gc.scene_objects = CHECK_PTR(scene_array_create(0));
+
+    fast_srand(SCENE_SEED);
+
+    add_ground(gc.scene_objects);
+
+    switch (id)
+    {
+        case SceneRandomField:
+            add_random_field(gc.scene_objects);
+            add_large_spheres(gc.scene_objects);
+            break;
+        case SceneGlass:
+            add_glass_field(gc.scene_objects);
+            break;
+        case SceneLights:
+            add_large_spheres(gc.scene_objects);
+            add_small_lights(gc.scene_objects);
+            break;
+        case SceneSpheres:
+        default:
+            add_large_spheres(gc.scene_objects);
+            break;
+    }
+
+    reset_accumulation();
+}
@@ -1,4 +1,5 @@
 #include "../include/util.h"
+#include "../include/prof.h"
 
 void log_error(int error_code, const char* file, int line)
 {
@@ -24,18 +25,17 @@ void swap(int* a, int* b)
     *b = temp;
 }
 
-__declspec(thread) u32 g_seed;
+THREAD_LOCAL rng_t g_rng;
 
 void fast_srand(u32 seed) 
 {
-    g_seed = seed;
+    rng_seed(&g_rng, 0, 0, seed);
 }
 
 // Output value in range [0, 32767]
 int fast_rand(void) 
 {
-    g_seed = (214013*g_seed+2531011);
-    return (g_seed>>16)&0x7FFF;
+    return (int)(rng_u32(&g_rng) >> 17);
 }
 
 vec2f_t vec2f(float x, float y)
@@ -169,34 +169,247 @@ vec3f_t vec3f_random_range(f32 min, f32 max)
 // direction vector of random points in a unit sphere
 vec3f_t vec3f_random_direction()
 {
-    for(size_t i = 0; i < 100; i++)
-    {
-        vec3f_t point_in_cube = vec3f_random_range(-1,1);
-        f32 lensq = vec3f_length_sq(point_in_cube);
-        // check if the point is inside a unit sphere
-        if(1e-15 < lensq && lensq <= 1)
-        {
-            // normalize to unit length
-            return vec3f_scale(point_in_cube,1.0f/sqrt_f32(lensq));
-        }
-    }
-    return (vec3f_t){0.0f,0.0f,0.0f};
+    f32 u1 = RAND_FLOAT();
+    f32 u2 = RAND_FLOAT();
+    return sample_uniform_sphere(u1, u2);
 }
 
+// random point in the unit disk
 vec3f_t vec3f_random_direction_2d(void)
 {
-    for(size_t i = 0; i < 100; i++)
-    {
-        vec3f_t point_in_plane = {RAND_FLOAT_RANGE(-1, 1), RAND_FLOAT_RANGE(-1, 1), 0.0f};
-        f32 lensq = vec3f_length_sq(point_in_plane);
+    f32 u1 = RAND_FLOAT();
+    f32 u2 = RAND_FLOAT();
+    return sample_concentric_disk(u1, u2);
+}
 
-        // check if the point is inside a unit sphere
-        if(1e-15 < lensq && lensq <= 1)
-        {
-            return point_in_plane;
-        }
+/*
+    sin and cos of (pi/4)*t for t in [-1,1], plain Taylor polynomials are
+    accurate to a few ulps on that range and vectorize without a lookup.
+*/
+static inline void sincos_quarter_pi(f32 t, f32 *s, f32 *c)
+{
+    f32 x  = t * (f32)(M_PI / 4.0);
+    f32 x2 = x * x;
+    *s = x * (1.0f + x2 * (-1.0f/6.0f + x2 * (1.0f/120.0f + x2 * (-1.0f/5040.0f))));
+    *c = 1.0f + x2 * (-0.5f + x2 * (1.0f/24.0f + x2 * (-1.0f/720.0f + x2 * (1.0f/40320.0f))));
+}
+
+/*
+    Shirley-Chiu concentric mapping, the square [-1,1]^2 is split in four wedges
+    and each wedge is mapped to a quarter of the disk. Unlike the polar mapping
+    it keeps strata compact and only needs the angle over [-pi/4,pi/4]:
+
+        |a| > |b| : r = a, phi = pi/4 * b/a             -> (r cos, r sin)
+        otherwise : r = b, phi = pi/2 - pi/4 * a/b      -> (r sin, r cos) of pi/4 * a/b
+*/
+vec3f_t sample_concentric_disk(f32 u1, f32 u2)
+{
+    f32 a = 2.0f * u1 - 1.0f;
+    f32 b = 2.0f * u2 - 1.0f;
+
+    bool wide = fabsf(a) > fabsf(b);
+    f32 r = wide ? a : b;
+    f32 t = (r != 0.0f) ? (wide ? b : a) / r : 0.0f;
+
+    f32 s, c;
+    sincos_quarter_pi(t, &s, &c);
+
+    return wide ? (vec3f_t){r * c, r * s, 0.0f} : (vec3f_t){r * s, r * c, 0.0f};
+}
+
+/*
+    Equal area map from the disk to the hemisphere: z = 1 - r^2 and xy scaled
+    by sqrt(2 - r^2). The first half of u1 picks the upper hemisphere.
+*/
+vec3f_t sample_uniform_sphere(f32 u1, f32 u2)
+{
+    bool upper = u1 < 0.5f;
+    f32 u = upper ? 2.0f * u1 : 2.0f * u1 - 1.0f;
+
+    vec3f_t d = sample_concentric_disk(u, u2);
+    f32 r2 = d.x * d.x + d.y * d.y;
+    f32 scale = sqrt_f32(fmaxf(0.0f, 2.0f - r2));
+    f32 z = 1.0f - r2;
+
+    return (vec3f_t){d.x * scale, d.y * scale, upper ? z : -z};
+}
+
+// (x, y, z) in the frame around the unit vector n, branchless basis of Duff et al. 2017
+static inline vec3f_t frame_to_world(vec3f_t n, f32 x, f32 y, f32 z)
+{
+    f32 sign = copysignf(1.0f, n.z);
+    f32 a = -1.0f / (sign + n.z);
+    f32 b = n.x * n.y * a;
+
+    vec3f_t t  = {1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x};
+    vec3f_t bt = {b, sign + n.y * n.y * a, -n.y};
+
+    return (vec3f_t){
+        t.x * x + bt.x * y + n.x * z,
+        t.y * x + bt.y * y + n.y * z,
+        t.z * x + bt.z * y + n.z * z,
+    };
+}
+
+/*
+    Malley's method: a uniform disk point lifted onto the hemisphere is cosine
+    distributed, then rotated into the frame of the normal.
+*/
+vec3f_t sample_cosine_hemisphere(vec3f_t n, f32 u1, f32 u2)
+{
+    vec3f_t d = sample_concentric_disk(u1, u2);
+    f32 z = sqrt_f32(fmaxf(0.0f, 1.0f - d.x * d.x - d.y * d.y));
+
+    return frame_to_world(n, d.x, d.y, z);
+}
+
+/*
+    Uniform over the solid angle of the cone around axis whose cap has height
+    1 - cos(theta_max), the same equal area lift as sample_uniform_sphere():
+    z = 1 - r^2 h and xy scaled by sqrt(h (2 - r^2 h)).
+    Taking the height instead of the cosine keeps precision for tiny cones.
+*/
+vec3f_t sample_uniform_cone(vec3f_t axis, f32 cap_height, f32 u1, f32 u2)
+{
+    vec3f_t d = sample_concentric_disk(u1, u2);
+    f32 r2 = d.x * d.x + d.y * d.y;
+    f32 z = 1.0f - r2 * cap_height;
+    f32 scale = sqrt_f32(fmaxf(0.0f, cap_height * (2.0f - r2 * cap_height)));
+
+    return frame_to_world(axis, d.x * scale, d.y * scale, z);
+}
+
+#ifdef __AVX__
+
+static inline void sincos_quarter_pi_x8(__m256 t, __m256 *s, __m256 *c)
+{
+    __m256 x  = _mm256_mul_ps(t, _mm256_set1_ps((f32)(M_PI / 4.0)));
+    __m256 x2 = _mm256_mul_ps(x, x);
+
+    __m256 ps = _mm256_set1_ps(-1.0f/5040.0f);
+    ps = _mm256_add_ps(_mm256_mul_ps(ps, x2), _mm256_set1_ps(1.0f/120.0f));
+    ps = _mm256_add_ps(_mm256_mul_ps(ps, x2), _mm256_set1_ps(-1.0f/6.0f));
+    ps = _mm256_add_ps(_mm256_mul_ps(ps, x2), _mm256_set1_ps(1.0f));
+    *s = _mm256_mul_ps(ps, x);
+
+    __m256 pc = _mm256_set1_ps(1.0f/40320.0f);
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(-1.0f/720.0f));
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(1.0f/24.0f));
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(-0.5f));
+    *c = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(1.0f));
+}
+
+static inline void concentric_disk_x8(__m256 u1, __m256 u2, __m256 *x, __m256 *y)
+{
+    __m256 one      = _mm256_set1_ps(1.0f);
+    __m256 two      = _mm256_set1_ps(2.0f);
+    __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+    __m256 a = _mm256_sub_ps(_mm256_mul_ps(two, u1), one);
+    __m256 b = _mm256_sub_ps(_mm256_mul_ps(two, u2), one);
+
+    __m256 wide = _mm256_cmp_ps(_mm256_and_ps(a, abs_mask), _mm256_and_ps(b, abs_mask), _CMP_GT_OQ);
+    __m256 r    = _mm256_blendv_ps(b, a, wide);
+    __m256 num  = _mm256_blendv_ps(a, b, wide);
+
+    // 0/0 at the center, divide by one there and the numerator is zero anyway
+    __m256 zero = _mm256_cmp_ps(r, _mm256_setzero_ps(), _CMP_EQ_OQ);
+    __m256 t    = _mm256_div_ps(num, _mm256_blendv_ps(r, one, zero));
+
+    __m256 s, c;
+    sincos_quarter_pi_x8(t, &s, &c);
+
+    *x = _mm256_mul_ps(r, _mm256_blendv_ps(s, c, wide));
+    *y = _mm256_mul_ps(r, _mm256_blendv_ps(c, s, wide));
+}
+
+#endif
+
+void sample_concentric_disk_x8(f32 const *u1, f32 const *u2, f32 *x, f32 *y)
+{
+#ifdef __AVX__
+    __m256 dx, dy;
+    concentric_disk_x8(_mm256_loadu_ps(u1), _mm256_loadu_ps(u2), &dx, &dy);
+    _mm256_storeu_ps(x, dx);
+    _mm256_storeu_ps(y, dy);
+#else
+    for (int i = 0; i < 8; i++) {
+        vec3f_t d = sample_concentric_disk(u1[i], u2[i]);
+        x[i] = d.x;
+        y[i] = d.y;
     }
-    return (vec3f_t){0.0f,0.0f,0.0f};
+#endif
+}
+
+void sample_uniform_sphere_x8(f32 const *u1, f32 const *u2, f32 *x, f32 *y, f32 *z)
+{
+#ifdef __AVX__
+    __m256 one  = _mm256_set1_ps(1.0f);
+    __m256 two  = _mm256_set1_ps(2.0f);
+    __m256 v1   = _mm256_loadu_ps(u1);
+
+    __m256 upper = _mm256_cmp_ps(v1, _mm256_set1_ps(0.5f), _CMP_LT_OQ);
+    __m256 u     = _mm256_mul_ps(two, v1);
+    u = _mm256_blendv_ps(_mm256_sub_ps(u, one), u, upper);
+
+    __m256 dx, dy;
+    concentric_disk_x8(u, _mm256_loadu_ps(u2), &dx, &dy);
+
+    __m256 r2    = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    __m256 scale = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(two, r2)));
+    __m256 dz    = _mm256_sub_ps(one, r2);
+
+    _mm256_storeu_ps(x, _mm256_mul_ps(dx, scale));
+    _mm256_storeu_ps(y, _mm256_mul_ps(dy, scale));
+    _mm256_storeu_ps(z, _mm256_blendv_ps(_mm256_sub_ps(_mm256_setzero_ps(), dz), dz, upper));
+#else
+    for (int i = 0; i < 8; i++) {
+        vec3f_t d = sample_uniform_sphere(u1[i], u2[i]);
+        x[i] = d.x;
+        y[i] = d.y;
+        z[i] = d.z;
+    }
+#endif
+}
+
+void sample_cosine_hemisphere_x8(f32 const *nx, f32 const *ny, f32 const *nz,
+                                 f32 const *u1, f32 const *u2, f32 *x, f32 *y, f32 *z)
+{
+#ifdef __AVX__
+    __m256 one  = _mm256_set1_ps(1.0f);
+    __m256 zero = _mm256_setzero_ps();
+
+    __m256 dx, dy;
+    concentric_disk_x8(_mm256_loadu_ps(u1), _mm256_loadu_ps(u2), &dx, &dy);
+    __m256 dz = _mm256_sqrt_ps(_mm256_max_ps(zero, _mm256_sub_ps(_mm256_sub_ps(one, _mm256_mul_ps(dx, dx)), _mm256_mul_ps(dy, dy))));
+
+    __m256 n_x = _mm256_loadu_ps(nx);
+    __m256 n_y = _mm256_loadu_ps(ny);
+    __m256 n_z = _mm256_loadu_ps(nz);
+
+    // copysign(1, nz)
+    __m256 sign = _mm256_or_ps(one, _mm256_and_ps(n_z, _mm256_set1_ps(-0.0f)));
+    __m256 a    = _mm256_div_ps(_mm256_set1_ps(-1.0f), _mm256_add_ps(sign, n_z));
+    __m256 b    = _mm256_mul_ps(_mm256_mul_ps(n_x, n_y), a);
+
+    __m256 t_x  = _mm256_add_ps(one, _mm256_mul_ps(_mm256_mul_ps(sign, _mm256_mul_ps(n_x, n_x)), a));
+    __m256 t_y  = _mm256_mul_ps(sign, b);
+    __m256 t_z  = _mm256_sub_ps(zero, _mm256_mul_ps(sign, n_x));
+    __m256 bt_x = b;
+    __m256 bt_y = _mm256_add_ps(sign, _mm256_mul_ps(_mm256_mul_ps(n_y, n_y), a));
+    __m256 bt_z = _mm256_sub_ps(zero, n_y);
+
+    _mm256_storeu_ps(x, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t_x, dx), _mm256_mul_ps(bt_x, dy)), _mm256_mul_ps(n_x, dz)));
+    _mm256_storeu_ps(y, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t_y, dx), _mm256_mul_ps(bt_y, dy)), _mm256_mul_ps(n_y, dz)));
+    _mm256_storeu_ps(z, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t_z, dx), _mm256_mul_ps(bt_z, dy)), _mm256_mul_ps(n_z, dz)));
+#else
+    for (int i = 0; i < 8; i++) {
+        vec3f_t d = sample_cosine_hemisphere((vec3f_t){nx[i], ny[i], nz[i]}, u1[i], u2[i]);
+        x[i] = d.x;
+        y[i] = d.y;
+        z[i] = d.z;
+    }
+#endif
 }
 
 bool vec3f_is_near_zero(vec3f_t vec)
@@ -482,6 +695,21 @@ void get_time(void *time)
     #endif
 }
 
+// monotonic timestamp in nanoseconds
+u64 get_time_ns(void)
+{
+    #ifdef _WIN32
+        LARGE_INTEGER now, f;
+        QueryPerformanceFrequency(&f);
+        QueryPerformanceCounter(&now);
+        return (u64)((f64)now.QuadPart * (1e9 / (f64)f.QuadPart));
+    #else
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+    #endif
+}
+
 thread_handle_t create_thread(thread_func_t func, thread_func_param_t data)
 {
     #ifdef _WIN32
@@ -518,4 +746,310 @@ int get_core_count(void)
     #else
         return sysconf(_SC_NPROCESSORS_ONLN);
     #endif
-}
\ No newline at end of file
+}
+
+void mutex_init(mutex_t *mutex)
+{
+    #ifdef _WIN32
+        InitializeCriticalSection(mutex);
+    #else
+        pthread_mutex_init(mutex, NULL);
+    #endif
+}
+
+void mutex_lock(mutex_t *mutex)
+{
+    #ifdef _WIN32
+        EnterCriticalSection(mutex);
+    #else
+        pthread_mutex_lock(mutex);
+    #endif
+}
+
+void mutex_unlock(mutex_t *mutex)
+{
+    #ifdef _WIN32
+        LeaveCriticalSection(mutex);
+    #else
+        pthread_mutex_unlock(mutex);
+    #endif
+}
+
+void mutex_destroy(mutex_t *mutex)
+{
+    #ifdef _WIN32
+        DeleteCriticalSection(mutex);
+    #else
+        pthread_mutex_destroy(mutex);
+    #endif
+}
+
+void cond_var_init(cond_var_t *cond)
+{
+    #ifdef _WIN32
+        InitializeConditionVariable(cond);
+    #else
+        pthread_cond_init(cond, NULL);
+    #endif
+}
+
+void cond_var_wait(cond_var_t *cond, mutex_t *mutex)
+{
+    #ifdef _WIN32
+        SleepConditionVariableCS(cond, mutex, INFINITE);
+    #else
+        pthread_cond_wait(cond, mutex);
+    #endif
+}
+
+void cond_var_signal(cond_var_t *cond)
+{
+    #ifdef _WIN32
+        WakeConditionVariable(cond);
+    #else
+        pthread_cond_signal(cond);
+    #endif
+}
+
+void cond_var_broadcast(cond_var_t *cond)
+{
+    #ifdef _WIN32
+        WakeAllConditionVariable(cond);
+    #else
+        pthread_cond_broadcast(cond);
+    #endif
+}
+
+void cond_var_destroy(cond_var_t *cond)
+{
+    #ifdef _WIN32
+        (void)cond; // windows condition variables don't need to be destroyed
+    #else
+        pthread_cond_destroy(cond);
+    #endif
+}
+
+typedef struct thread_pool_worker_t
+{
+    thread_pool_t *pool;
+    u32            index;
+    void          *scratch;     // see thread_pool_scratch(), only touched by the worker itself
+}thread_pool_worker_t;
+
+// worker the calling thread runs, NULL outside of a pool
+static THREAD_LOCAL thread_pool_worker_t *g_current_worker;
+
+struct thread_pool_t
+{
+    thread_handle_t      *threads;
+    thread_pool_worker_t *workers;
+    thread_pool_stats_t  *stats;        // one slot per worker, only written by its owner
+    u32                   thread_count;
+
+    /* Current batch */
+    task_func_t           func;
+    u8                   *items;
+    size_t                item_stride;
+    u32                   item_count;
+    volatile u32          next_item;    // claimed with ATOMIC_FETCH_ADD_U32
+    u64                   batch_start_ns;
+    f64                   batch_ms;
+
+    u32                   generation;   // bumped by every dispatch
+    u32                   active_workers;
+
+    mutex_t               lock;
+    cond_var_t            work_available;   // workers park here between frames
+    cond_var_t            work_done;        // thread_pool_wait() parks here
+    bool                  shutdown;
+};
+
+thread_func_ret_t thread_pool_worker(thread_func_param_t param)
+{
+    thread_pool_worker_t *worker = (thread_pool_worker_t *)param;
+    thread_pool_t *pool = worker->pool;
+
+    g_current_worker = worker;
+
+    u32 seen_generation = 0;
+
+    for(;;)
+    {
+        mutex_lock(&pool->lock);
+
+        while(pool->generation == seen_generation && !pool->shutdown){
+            cond_var_wait(&pool->work_available, &pool->lock);
+        }
+
+        if(pool->shutdown){
+            mutex_unlock(&pool->lock);
+            break;
+        }
+
+        seen_generation = pool->generation;
+
+        mutex_unlock(&pool->lock);
+
+        u64 busy_ns = 0;
+        u32 tasks_run = 0;
+
+        for(;;)
+        {
+            u32 idx = ATOMIC_FETCH_ADD_U32(&pool->next_item, 1);
+            if(idx >= pool->item_count){
+                break;
+            }
+
+            u64 start = get_time_ns();
+            pool->func(pool->items + idx * pool->item_stride);
+            busy_ns += get_time_ns() - start;
+            tasks_run++;
+        }
+
+        pool->stats[worker->index].busy_ms   = (f64)busy_ns / 1e6;
+        pool->stats[worker->index].tasks_run = tasks_run;
+
+        mutex_lock(&pool->lock);
+        pool->active_workers--;
+        if(pool->active_workers == 0){
+            cond_var_broadcast(&pool->work_done);
+        }
+        mutex_unlock(&pool->lock);
+    }
+
+    // the next pool's workers take over this thread's profile storage
+    prof_thread_release();
+
+    #ifdef _WIN32
+        return 0;
+    #else
+        return NULL;
+    #endif
+}
+
+thread_pool_t *thread_pool_create(u32 thread_count)
+{
+    if(thread_count == 0){
+        thread_count = 1;
+    }
+
+    thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+    if(!pool){
+        return NULL;
+    }
+
+    pool->threads = malloc(sizeof(thread_handle_t) * thread_count);
+    pool->workers = malloc(sizeof(thread_pool_worker_t) * thread_count);
+    pool->stats   = calloc(thread_count, sizeof(thread_pool_stats_t));
+
+    if(!pool->threads || !pool->workers || !pool->stats){
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->stats);
+        free(pool);
+        return NULL;
+    }
+
+    mutex_init(&pool->lock);
+    cond_var_init(&pool->work_available);
+    cond_var_init(&pool->work_done);
+
+    pool->thread_count = thread_count;
+
+    for(u32 i = 0; i < thread_count; i++)
+    {
+        pool->workers[i] = (thread_pool_worker_t){pool, i, NULL};
+        pool->threads[i] = create_thread(thread_pool_worker, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+void thread_pool_dispatch(thread_pool_t *pool, task_func_t func, void *items, u32 item_count, size_t item_stride)
+{
+    // only one batch in flight at a time
+    thread_pool_wait(pool);
+
+    mutex_lock(&pool->lock);
+
+    pool->func           = func;
+    pool->items          = (u8 *)items;
+    pool->item_stride    = item_stride;
+    pool->item_count     = item_count;
+    pool->next_item      = 0;
+    pool->batch_start_ns = get_time_ns();
+
+    pool->active_workers = pool->thread_count;
+    pool->generation++;
+
+    cond_var_broadcast(&pool->work_available);
+    mutex_unlock(&pool->lock);
+}
+
+void thread_pool_wait(thread_pool_t *pool)
+{
+    mutex_lock(&pool->lock);
+    while(pool->active_workers > 0){
+        cond_var_wait(&pool->work_done, &pool->lock);
+    }
+    if(pool->batch_start_ns){
+        pool->batch_ms = (f64)(get_time_ns() - pool->batch_start_ns) / 1e6;
+        pool->batch_start_ns = 0;
+    }
+    mutex_unlock(&pool->lock);
+}
+
+u32 thread_pool_thread_count(thread_pool_t *pool)
+{
+    return pool->thread_count;
+}
+
+void thread_pool_get_stats(thread_pool_t *pool, u32 worker, thread_pool_stats_t *stats)
+{
+    assert(worker < pool->thread_count);
+
+    *stats = pool->stats[worker];
+    stats->idle_ms = MAX(0.0, pool->batch_ms - stats->busy_ms);
+}
+
+void *thread_pool_scratch(size_t size)
+{
+    thread_pool_worker_t *worker = g_current_worker;
+    assert(worker);
+
+    if(!worker->scratch){
+        worker->scratch = CHECK_PTR(malloc(size));
+    }
+
+    return worker->scratch;
+}
+
+void thread_pool_destroy(thread_pool_t **pool)
+{
+    assert(pool && *pool);
+
+    thread_pool_t *p = *pool;
+
+    thread_pool_wait(p);
+
+    mutex_lock(&p->lock);
+    p->shutdown = true;
+    cond_var_broadcast(&p->work_available);
+    mutex_unlock(&p->lock);
+
+    for(u32 i = 0; i < p->thread_count; i++){
+        join_thread(p->threads[i]);
+        free(p->workers[i].scratch);
+    }
+
+    cond_var_destroy(&p->work_available);
+    cond_var_destroy(&p->work_done);
+    mutex_destroy(&p->lock);
+
+    free(p->threads);
+    free(p->workers);
+    free(p->stats);
+    free(p);
+
+    *pool = NULL;
+}